@@ -1,27 +1,67 @@
 // orderbook_v0.2.cpp
 // C++20 version
 // Compile with: g++ -std=c++20 -pthread -O2 -DORDERBOOK_SINGLE_MAIN orderbook_v0.2.cpp
+// Differential check: g++ -std=c++20 -pthread -O2 -DORDERBOOK_DIFF_MAIN orderbook_v0.2.cpp
+//   ./a.out [seed] [events]   or   ./a.out --replay commands.txt
+// Backend benchmarks: g++ -std=c++20 -pthread -O2 -DORDERBOOK_BENCH_MAIN orderbook_v0.2.cpp
 
 #include <algorithm>
+#include <array>
 #include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <bit>
 #include <chrono>
+#include <cmath>
+#include <concepts>
 #include <condition_variable>
+#include <coroutine>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <limits>
 #include <list>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <random>
+#include <span>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <system_error>
 #include <thread>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 #include <format> // for std::format in C++20
 
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// ----- hints -----
+#if defined(__GNUC__) || defined(__clang__)
+#define ORDERBOOK_PREFETCH(addr) __builtin_prefetch((addr), 1, 3) // for write, keep in all cache levels
+#else
+#define ORDERBOOK_PREFETCH(addr) ((void)(addr))
+#endif
+
 // ----- type definitions -----
 using Price = int32_t;
 using Quantity = uint32_t;
 using OrderId = uint64_t;
+using OwnerId = uint32_t; // client session that entered an order; 0 for none
 using TimePoint = std::chrono::system_clock::time_point;
 
 // ----- enums -----
@@ -35,29 +75,94 @@ enum class OrderType {
     Market           // filled for the quantity, independent of price
 };
 
+// trading phase of a book; only Continuous matches on arrival, the auction phases and Halted
+// collect resting orders (the book may cross) until the uncross that ends them
+enum class SessionState : uint8_t { Closed, PreOpen, OpeningAuction, Continuous, Halted, ClosingAuction };
+
+inline const char* SessionStateName(SessionState s) {
+    switch (s) {
+        case SessionState::Closed: return "closed";
+        case SessionState::PreOpen: return "pre-open";
+        case SessionState::OpeningAuction: return "opening auction";
+        case SessionState::Continuous: return "continuous";
+        case SessionState::Halted: return "halted";
+        case SessionState::ClosingAuction: return "closing auction";
+    }
+    return "?";
+}
+
+// session transitions delivered to a book by its owner (see SessionScheduler); Open also resumes
+// a halted book
+enum class SessionEvent : uint8_t { PreOpen, Open, Close, ExpireGoodForDay, OpeningAuction, ClosingAuction, Halt };
+inline constexpr uint8_t SessionEventCount = 7;
+
+inline const char* SessionEventName(SessionEvent e) {
+    switch (e) {
+        case SessionEvent::PreOpen: return "PREOPEN";
+        case SessionEvent::Open: return "OPEN";
+        case SessionEvent::Close: return "CLOSE";
+        case SessionEvent::ExpireGoodForDay: return "EXPIRE_GFD";
+        case SessionEvent::OpeningAuction: return "OPENING_AUCTION";
+        case SessionEvent::ClosingAuction: return "CLOSING_AUCTION";
+        case SessionEvent::Halt: return "HALT";
+    }
+    return "?";
+}
+
+// every legal session transition; any other (state, event) pair is refused and changes nothing.
+// ExpireGoodForDay is legal in every state and keeps it
+struct SessionTransition { SessionState from; SessionEvent event; SessionState to; };
+inline constexpr SessionTransition SessionTransitions[] = {
+    {SessionState::Closed,         SessionEvent::PreOpen,        SessionState::PreOpen},
+    {SessionState::PreOpen,        SessionEvent::OpeningAuction, SessionState::OpeningAuction},
+    {SessionState::PreOpen,        SessionEvent::Open,           SessionState::Continuous},
+    {SessionState::PreOpen,        SessionEvent::Close,          SessionState::Closed},
+    {SessionState::OpeningAuction, SessionEvent::Open,           SessionState::Continuous},
+    {SessionState::OpeningAuction, SessionEvent::Halt,           SessionState::Halted},
+    {SessionState::OpeningAuction, SessionEvent::Close,          SessionState::Closed},
+    {SessionState::Continuous,     SessionEvent::Halt,           SessionState::Halted},
+    {SessionState::Continuous,     SessionEvent::ClosingAuction, SessionState::ClosingAuction},
+    {SessionState::Continuous,     SessionEvent::Close,          SessionState::Closed},
+    {SessionState::Halted,         SessionEvent::Open,           SessionState::Continuous},
+    {SessionState::Halted,         SessionEvent::Close,          SessionState::Closed},
+    {SessionState::ClosingAuction, SessionEvent::Halt,           SessionState::Halted},
+    {SessionState::ClosingAuction, SessionEvent::Close,          SessionState::Closed},
+};
+
+// the state an event moves a book in `from` into; empty if the transition is not legal
+constexpr std::optional<SessionState> StateAfter(SessionState from, SessionEvent e) noexcept {
+    if (e == SessionEvent::ExpireGoodForDay) return from;
+    for (const auto& t : SessionTransitions)
+        if (t.from == from && t.event == e) return t.to;
+    return std::nullopt;
+}
+static_assert(!StateAfter(SessionState::Closed, SessionEvent::Halt) && StateAfter(SessionState::Halted, SessionEvent::Open) == SessionState::Continuous);
+
 // ----- Order -----
 struct Order {
     Order(OrderType t, OrderId id, Side s, Price p, Quantity q,
-          TimePoint ts = std::chrono::system_clock::now())
+          TimePoint ts = std::chrono::system_clock::now(), OwnerId owner = 0)
         : type(t), id(id), side(s), price(p),
-          initialQuantity(q), remainingQuantity(q), timestamp(ts) {}
+          initialQuantity(q), remainingQuantity(q), timestamp(ts), owner(owner) {}
 
-    OrderId GetOrderId() const { return id; }
-    Side GetSide() const { return side; }
-    OrderType GetOrderType() const { return type; }
-    Price GetPrice() const { return price; }
-    Quantity GetInitialQuantity() const { return initialQuantity; }
-    Quantity GetRemainingQuantity() const { return remainingQuantity; }
-    bool IsFilled() const { return remainingQuantity == 0; }
+    OrderId GetOrderId() const noexcept { return id; }
+    Side GetSide() const noexcept { return side; }
+    OrderType GetOrderType() const noexcept { return type; }
+    Price GetPrice() const noexcept { return price; }
+    Quantity GetInitialQuantity() const noexcept { return initialQuantity; }
+    Quantity GetRemainingQuantity() const noexcept { return remainingQuantity; }
+    bool IsFilled() const noexcept { return remainingQuantity == 0; }
+    TimePoint GetTimestamp() const noexcept { return timestamp; }
+    OwnerId GetOwner() const noexcept { return owner; }
 
-    // when a trade happens, fill quantity
-    void Fill(Quantity q) {
-        if (q > remainingQuantity) throw std::logic_error(std::format("Order {} fill > remaining", id));
+    // when a trade happens, fill quantity; the book only ever fills min(bid, ask) remaining
+    void Fill(Quantity q) noexcept {
+        assert(q <= remainingQuantity && "fill exceeds remaining quantity");
         remainingQuantity -= q;
     }
 
     // convert a market order into a price-capped limit order
-    void ToGoodTillCancel(Price worstPrice) {
+    void ToGoodTillCancel(Price worstPrice) noexcept {
         if (type == OrderType::Market) {
             type = OrderType::GoodTillCancel;
             price = worstPrice;
@@ -72,20 +177,21 @@ private:
     Quantity initialQuantity;
     Quantity remainingQuantity;
     TimePoint timestamp;
+    OwnerId owner;
 };
 
 // ----- OrderModify -----
 struct OrderModify {
-    OrderModify(OrderId id, Side s, Price p, Quantity q)
-        : orderId(id), side(s), price(p), quantity(q) {}
+    OrderModify(OrderId id, Side s, Price p, Quantity q, TimePoint ts = std::chrono::system_clock::now())
+        : orderId(id), side(s), price(p), quantity(q), timestamp(ts) {}
     OrderId GetOrderId() const { return orderId; }
     Price GetPrice() const { return price; }
     Side GetSide() const { return side; }
     Quantity GetQuantity() const { return quantity; }
 
-    // produce a new Order preserving the type
-    std::shared_ptr<Order> ToOrderPointer(OrderType type) const {
-        return std::make_shared<Order>(type, orderId, side, price, quantity);
+    // produce a new Order preserving the type and owner
+    std::shared_ptr<Order> ToOrderPointer(OrderType type, OwnerId owner = 0) const {
+        return std::make_shared<Order>(type, orderId, side, price, quantity, timestamp, owner);
     }
 
 private:
@@ -93,211 +199,3535 @@ private:
     Side side;
     Price price;
     Quantity quantity;
+    TimePoint timestamp;
 };
 
 // ----- Trade -----
-struct TradeInfo { OrderId orderId; Price price; Quantity quantity; };
-struct Trade { Trade(TradeInfo b, TradeInfo a) : bid(b), ask(a) {} TradeInfo bid; TradeInfo ask; };
+struct TradeInfo { OrderId orderId; Price price; Quantity quantity; bool operator==(const TradeInfo&) const = default; };
+// both legs carry the execution price, which is the resting order's price; sequence numbers
+// executions within one book, starting at 1
+struct Trade {
+    Trade(TradeInfo b, TradeInfo a, Side aggressor, uint64_t sequence) : bid(b), ask(a), aggressor(aggressor), sequence(sequence) {}
+    TradeInfo bid; TradeInfo ask;
+    Side aggressor;    // side of the incoming order that took liquidity
+    uint64_t sequence;
+    bool operator==(const Trade&) const = default;
+};
+// ----- results -----
+// why an order produced no book change; None means it was accepted (it may still have rested without trading)
+enum class RejectReason : uint8_t {
+    None,
+    DuplicateOrderId,
+    UnknownOrderId,       // cancel/modify of an order that is not resting
+    InvalidPrice,         // limit price must be positive
+    InvalidQuantity,      // zero quantity
+    NoLiquidity,          // market order against an empty opposite side
+    FillAndKillNoMatch,   // FAK priced through nothing
+    FillOrKillUnfillable, // FOK whose full quantity is not available at its price
+    NotAllowedInSession,  // order type not accepted in the book's current session state, or an illegal session transition
+    OutsidePriceBand,     // limit price too far from the reference price (see PriceLimits)
+    Throttled,            // the client session is over its message rate; never reached the book
+    OffTick,              // limit price not on the instrument's tick grid
+    InvalidLot,           // quantity not a whole number of lots, or outside the instrument's min/max
+    NotPermitted,         // command a client session may not send, or cancel/modify of another owner's order
+};
+
+inline const char* RejectReasonName(RejectReason r) noexcept {
+    switch (r) {
+        case RejectReason::None: return "none";
+        case RejectReason::DuplicateOrderId: return "duplicate order id";
+        case RejectReason::UnknownOrderId: return "unknown order id";
+        case RejectReason::InvalidPrice: return "invalid price";
+        case RejectReason::InvalidQuantity: return "invalid quantity";
+        case RejectReason::NoLiquidity: return "no liquidity";
+        case RejectReason::FillAndKillNoMatch: return "fill-and-kill would not match";
+        case RejectReason::FillOrKillUnfillable: return "fill-or-kill cannot fully fill";
+        case RejectReason::NotAllowedInSession: return "order type not allowed in this session state";
+        case RejectReason::OutsidePriceBand: return "price outside band";
+        case RejectReason::Throttled: return "throttled";
+        case RejectReason::OffTick: return "price off tick";
+        case RejectReason::InvalidLot: return "invalid lot";
+        case RejectReason::NotPermitted: return "not permitted";
+    }
+    return "?";
+}
+
+struct OrderResult {
+    std::vector<Trade> trades;
+    RejectReason reject = RejectReason::None;
+    bool Accepted() const noexcept { return reject == RejectReason::None; }
+};
+
 struct LevelData { uint32_t count = 0; uint64_t quantity = 0; };
 
-// ----- OrderBook -----
-class OrderBook {
+// ----- price levels -----
+using OrderPointers = std::list<std::shared_ptr<Order>>;
+
+// where an order joined its level's queue, and the level's counters at that moment
+struct QueueMark { uint32_t slot = 0; uint64_t ahead = 0, consumed = 0, cancelled = 0; };
+
+// queue-position bookkeeping for one level. Arrivals get consecutive slots; fills always come off
+// the front, so one counter covers them, while cancelled quantity is kept by slot in a Fenwick tree.
+// The quantity still ahead of an order is what was ahead when it joined minus fills since and
+// minus cancels since at earlier slots: O(log n) with no walk of the queue.
+class LevelQueue {
 public:
-    using OrderPtr = std::shared_ptr<Order>;
-    using OrderPointers = std::list<OrderPtr>;
-    struct OrderEntry { OrderPtr order; OrderPointers::iterator it; };
+    QueueMark Join(uint64_t ahead) {
+        const size_t i = tree_.size() + 1; // 1-based Fenwick index of the new slot, which starts at 0
+        tree_.push_back(Prefix(i - 1) - Prefix(i - (i & -i)));
+        return {uint32_t(i - 1), ahead, consumed_, cancelled_};
+    }
+    void Fill(uint64_t qty) noexcept { consumed_ += qty; }
+    void Leave(const QueueMark& mark, uint64_t remaining) noexcept {
+        for (size_t i = size_t(mark.slot) + 1; i <= tree_.size(); i += i & -i) tree_[i - 1] += remaining;
+        cancelled_ += remaining;
+    }
+    uint64_t Ahead(const QueueMark& mark) const noexcept {
+        const uint64_t gone = (consumed_ - mark.consumed) + (Prefix(mark.slot) - mark.cancelled);
+        return gone >= mark.ahead ? 0 : mark.ahead - gone;
+    }
+    // slots are never reused while the level lives; renumber once they outgrow the live orders
+    bool NeedsCompaction(uint32_t liveOrders) const noexcept { return tree_.size() >= 2 * size_t(liveOrders) + 64; }
+
+private:
+    std::vector<uint64_t> tree_;
+    uint64_t consumed_ = 0, cancelled_ = 0;
+
+    // cancelled quantity over the first n slots
+    uint64_t Prefix(size_t n) const noexcept { uint64_t sum = 0; for (; n > 0; n -= n & -n) sum += tree_[n - 1]; return sum; }
+};
+
+// one price level: resting orders in time priority plus their running aggregate
+struct PriceLevel { OrderPointers orders; LevelData data; LevelQueue queue; };
+
+// contiguous sides relocate levels when they grow; std::list keeps element iterators valid across moves
+static_assert(std::is_nothrow_move_constructible_v<PriceLevel> && std::is_nothrow_move_assignable_v<PriceLevel>);
+
+// handle to a level inside a side; level is null when there is no such level
+struct LevelRef {
+    Price price = 0;
+    PriceLevel* level = nullptr;
+    explicit operator bool() const { return level != nullptr; }
+};
+
+constexpr Side Opposite(Side s) { return s == Side::Buy ? Side::Sell : Side::Buy; }
+
+// bids improve upwards, asks downwards
+template<Side S> constexpr bool IsBetter(Price a, Price b) {
+    if constexpr (S == Side::Buy) return a > b; else return a < b;
+}
+
+// ----- book side concept -----
+// a side owns its price levels ordered best-first; the book only talks to it through this surface,
+// so the container can be chosen per instrument class at compile time
+template<class T>
+concept BookSide = requires(T s, const T cs, Price p, bool (*visit)(Price, const PriceLevel&)) {
+    { s.Insert(p) } -> std::same_as<PriceLevel&>;   // find or create
+    s.Erase(p);                                      // drop a level (no-op if absent)
+    { s.Find(p) } -> std::same_as<PriceLevel*>;
+    { cs.Find(p) } -> std::same_as<const PriceLevel*>;
+    { s.Best() } -> std::same_as<LevelRef>;
+    { s.NextBest(p) } -> std::same_as<LevelRef>;    // best level strictly worse than p
+    { s.Worst() } -> std::same_as<LevelRef>;
+    { cs.BestPrice() } -> std::same_as<Price>;      // precondition: !Empty()
+    { cs.Empty() } -> std::same_as<bool>;
+    { cs.LevelCount() } -> std::same_as<size_t>;
+    cs.ForEach(visit);                               // best-first; visitor returns false to stop
+    cs.ForEachTo(p, visit);                          // best-first, only levels at least as good as p
+};
+
+// ----- MapSide -----
+// red-black tree of levels; the reference backend
+template<Side S>
+class MapSide {
+public:
+    PriceLevel& Insert(Price p) { return levels_[p]; }
+    void Erase(Price p) { levels_.erase(p); }
+    PriceLevel* Find(Price p) { return const_cast<PriceLevel*>(std::as_const(*this).Find(p)); }
+    const PriceLevel* Find(Price p) const { auto it = levels_.find(p); return it == levels_.end() ? nullptr : &it->second; }
 
-    // constructor starts pruning thread
-    OrderBook() : shutdown_(false), pruneThread_([this]{ PruneGoodForDayOrders(); }) {}
+    LevelRef Best() { if (levels_.empty()) return {}; auto& [p, lvl] = *levels_.begin(); return {p, &lvl}; }
+    LevelRef NextBest(Price p) { auto it = levels_.upper_bound(p); if (it == levels_.end()) return {}; return {it->first, &it->second}; }
+    LevelRef Worst() { if (levels_.empty()) return {}; auto& [p, lvl] = *levels_.rbegin(); return {p, &lvl}; }
+    Price BestPrice() const { return levels_.begin()->first; }
 
-    // destructor joins thread
-    ~OrderBook() {
-        shutdown_.store(true);
-        cv_.notify_one();
-        if (pruneThread_.joinable()) pruneThread_.join();
+    bool Empty() const { return levels_.empty(); }
+    size_t LevelCount() const { return levels_.size(); }
+
+    template<class F> void ForEach(F&& visit) const { for (const auto& [p, lvl] : levels_) if (!visit(p, lvl)) return; }
+    template<class F> void ForEachTo(Price limit, F&& visit) const {
+        for (const auto& [p, lvl] : levels_) { if (IsBetter<S>(limit, p) || !visit(p, lvl)) return; }
     }
 
-    // add order, return trades executed by this add
-    std::vector<Trade> AddOrder(const OrderPtr& order) {
-        std::scoped_lock lock(mutex_);
-        if (orders_.contains(order->GetOrderId())) return {}; // duplicate id ignored
+private:
+    using Compare = std::conditional_t<S == Side::Buy, std::greater<Price>, std::less<Price>>;
+    std::map<Price, PriceLevel, Compare> levels_;
+};
 
-        // Market order conversion: convert into worst-price limit order
-        if (order->GetOrderType() == OrderType::Market) {
-            if (order->GetSide() == Side::Buy && !asks_.empty()) order->ToGoodTillCancel(asks_.rbegin()->first);
-            else if (order->GetSide() == Side::Sell && !bids_.empty()) order->ToGoodTillCancel(bids_.rbegin()->first);
-            else return {}; // no liquidity
+// ----- LadderSide -----
+// dense tick-indexed array of levels with an occupancy bitmap; O(1) insert/find, best/next-best by
+// bit scan. Memory is proportional to the price range spanned, so it suits instruments whose
+// resting prices stay within a bounded number of ticks. The array stops growing at MaxSpan ticks;
+// levels it cannot address spill into an ordered tree, which stays empty in the common case.
+template<Side S>
+class LadderSide {
+public:
+    PriceLevel& Insert(Price p) {
+        if (!EnsureRange(p)) [[unlikely]] return far_[p];
+        const size_t i = Index(p);
+        if (!Test(i)) {
+            Set(i);
+            if (count_++ == 0 || IsBetter<S>(p, best_)) best_ = p;
         }
+        return levels_[i];
+    }
 
-        // FillAndKill / FillOrKill pre-checks
-        if (order->GetOrderType() == OrderType::FillAndKill &&
-            !CanMatch(order->GetSide(), order->GetPrice())) return {};
-        if (order->GetOrderType() == OrderType::FillOrKill &&
-            !CanFullyFill(order->GetSide(), order->GetPrice(), order->GetInitialQuantity())) return {};
-
-        // insert order
-        OrderPointers::iterator it;
-        if (order->GetSide() == Side::Buy) {
-            auto& lvl = bids_[order->GetPrice()];
-            lvl.push_back(order);
-            it = std::prev(lvl.end());
-        } else {
-            auto& lvl = asks_[order->GetPrice()];
-            lvl.push_back(order);
-            it = std::prev(lvl.end());
+    void Erase(Price p) {
+        if (!InRange(p)) { far_.erase(p); return; }
+        if (!Test(Index(p))) return;
+        const size_t i = Index(p);
+        Clear(i); levels_[i] = PriceLevel{};
+        if (--count_ > 0 && p == best_) best_ = PriceAt(S == Side::Buy ? ScanDown(int64_t(i) - 1) : ScanUp(int64_t(i) + 1));
+    }
+
+    PriceLevel* Find(Price p) { return const_cast<PriceLevel*>(std::as_const(*this).Find(p)); }
+    const PriceLevel* Find(Price p) const {
+        if (InRange(p)) return Test(Index(p)) ? &levels_[Index(p)] : nullptr;
+        auto it = far_.find(p);
+        return it == far_.end() ? nullptr : &it->second;
+    }
+
+    LevelRef Best() { return BetterOf(count_ ? LevelRef{best_, &levels_[Index(best_)]} : LevelRef{}, far_.begin()); }
+    LevelRef NextBest(Price p) {
+        const int64_t from = int64_t(p) - base_;
+        return BetterOf(count_ ? RefAt(S == Side::Buy ? ScanDown(from - 1) : ScanUp(from + 1)) : LevelRef{}, far_.upper_bound(p));
+    }
+    LevelRef Worst() {
+        const LevelRef ladder = count_ ? RefAt(S == Side::Buy ? ScanUp(0) : ScanDown(int64_t(levels_.size()) - 1)) : LevelRef{};
+        if (far_.empty()) [[likely]] return ladder;
+        auto& [p, lvl] = *far_.rbegin();
+        return ladder && IsBetter<S>(p, ladder.price) ? ladder : LevelRef{p, &lvl};
+    }
+    Price BestPrice() const {
+        if (far_.empty()) [[likely]] return best_;
+        return count_ && IsBetter<S>(best_, far_.begin()->first) ? best_ : far_.begin()->first;
+    }
+
+    bool Empty() const { return count_ == 0 && far_.empty(); }
+    size_t LevelCount() const { return count_ + far_.size(); }
+
+    template<class F> void ForEach(F&& visit) const {
+        ForEachTo(S == Side::Buy ? std::numeric_limits<Price>::min() : std::numeric_limits<Price>::max(), visit);
+    }
+    // ladder and tree merged best first
+    template<class F> void ForEachTo(Price limit, F&& visit) const {
+        auto far = far_.begin();
+        size_t i = count_ ? Index(best_) : npos;
+        while (i != npos || far != far_.end()) {
+            const bool ladder = far == far_.end() || (i != npos && IsBetter<S>(PriceAt(i), far->first));
+            const Price p = ladder ? PriceAt(i) : far->first;
+            if (IsBetter<S>(limit, p) || !visit(p, ladder ? levels_[i] : far->second)) return;
+            if (ladder) i = S == Side::Buy ? ScanDown(int64_t(i) - 1) : ScanUp(int64_t(i) + 1);
+            else ++far;
         }
+    }
+
+private:
+    static constexpr size_t npos = std::numeric_limits<size_t>::max();
+    static constexpr size_t InitialSpan = 1024;   // ticks, multiple of 64
+    static constexpr size_t MaxSpan = size_t{1} << 16; // ticks, multiple of 64
+    using Compare = std::conditional_t<S == Side::Buy, std::greater<Price>, std::less<Price>>;
+    using FarLevels = std::map<Price, PriceLevel, Compare>;
 
-        orders_.insert({order->GetOrderId(), OrderEntry{order, it}});
-        OnOrderAdded(order);
+    std::vector<PriceLevel> levels_;
+    std::vector<uint64_t> occupied_; // bit i set <=> levels_[i] is a live level
+    int64_t base_ = 0;               // price of levels_[0]
+    size_t count_ = 0;               // live levels in the array
+    Price best_ = 0;                 // best price in the array, if count_
+    FarLevels far_;                  // invariant: no key is InRange
 
-        return MatchOrders();
+    size_t Index(Price p) const { return size_t(int64_t(p) - base_); }
+    Price PriceAt(size_t i) const { return Price(base_ + int64_t(i)); }
+    bool InRange(Price p) const { return int64_t(p) >= base_ && int64_t(p) < base_ + int64_t(levels_.size()); }
+    bool Test(size_t i) const { return occupied_[i >> 6] >> (i & 63) & 1; }
+    void Set(size_t i) { occupied_[i >> 6] |= uint64_t{1} << (i & 63); }
+    void Clear(size_t i) { occupied_[i >> 6] &= ~(uint64_t{1} << (i & 63)); }
+    LevelRef RefAt(size_t i) { return i == npos ? LevelRef{} : LevelRef{PriceAt(i), &levels_[i]}; }
+    LevelRef BetterOf(LevelRef ladder, typename FarLevels::iterator far) {
+        if (far == far_.end() || (ladder && IsBetter<S>(ladder.price, far->first))) return ladder;
+        return {far->first, &far->second};
     }
 
-    // cancel an order
-    void CancelOrder(OrderId id) {
-        std::scoped_lock lock(mutex_);
-        CancelOrderInternal(id);
+    // lowest set index >= from
+    size_t ScanUp(int64_t from) const {
+        if (from >= int64_t(levels_.size())) return npos;
+        size_t i = size_t(std::max<int64_t>(from, 0));
+        size_t w = i >> 6;
+        uint64_t bits = occupied_[w] & (~uint64_t{0} << (i & 63));
+        while (!bits) { if (++w == occupied_.size()) return npos; bits = occupied_[w]; }
+        return (w << 6) + size_t(std::countr_zero(bits));
     }
+    // highest set index <= from
+    size_t ScanDown(int64_t from) const {
+        if (from < 0) return npos;
+        size_t i = size_t(std::min<int64_t>(from, int64_t(levels_.size()) - 1));
+        size_t w = i >> 6;
+        uint64_t bits = occupied_[w] & (~uint64_t{0} >> (63 - (i & 63)));
+        while (!bits) { if (w-- == 0) return npos; bits = occupied_[w]; }
+        return (w << 6) + 63 - size_t(std::countl_zero(bits));
+    }
+
+    // grow (at least doubling, at most to MaxSpan) so p is addressable; live levels are moved, their
+    // orders stay put, and tree levels the new range covers move in. False if p is out of reach
+    bool EnsureRange(Price p) {
+        if (levels_.empty()) {
+            base_ = int64_t(p) - int64_t(InitialSpan / 2);
+            levels_.resize(InitialSpan); occupied_.assign(InitialSpan / 64, 0);
+            return true;
+        }
+        if (InRange(p)) [[likely]] return true;
+        const int64_t lo = std::min<int64_t>(base_, p), hi = std::max<int64_t>(base_ + int64_t(levels_.size()) - 1, p);
+        if (uint64_t(hi - lo) >= MaxSpan) return false;
+        const size_t size = std::min(std::max(levels_.size() * 2, (size_t(hi - lo + 1) + 63) & ~size_t{63}), MaxSpan);
+        const int64_t base = int64_t(p) < base_ ? hi - int64_t(size) + 1 : lo;
 
-    // cancel then re-add with same type
-    std::vector<Trade> ModifyOrder(const OrderModify& mod) {
-        OrderType typeToKeep;
-        { std::scoped_lock lock(mutex_); if(!orders_.contains(mod.GetOrderId())) return {}; typeToKeep = orders_.at(mod.GetOrderId()).order->GetOrderType(); }
-        CancelOrder(mod.GetOrderId());
-        return AddOrder(mod.ToOrderPointer(typeToKeep));
+        std::vector<PriceLevel> levels(size);
+        std::vector<uint64_t> occupied(size / 64, 0);
+        for (size_t i = ScanUp(0); i != npos; i = ScanUp(int64_t(i) + 1)) {
+            const size_t j = size_t(base_ + int64_t(i) - base);
+            levels[j] = std::move(levels_[i]);
+            occupied[j >> 6] |= uint64_t{1} << (j & 63);
+        }
+        levels_.swap(levels); occupied_.swap(occupied); base_ = base;
+        AdoptFar();
+        return true;
     }
 
-    // snapshot of top N levels
-    std::vector<std::pair<Price,uint64_t>> GetBidLevels(size_t depth=5) const {
-        std::scoped_lock lock(mutex_);
-        std::vector<std::pair<Price,uint64_t>> out; out.reserve(depth);
-        for (const auto& [p,lvl]: bids_) {
-            if(out.size()>=depth) break;
-            uint64_t qty=0; for(auto& o:lvl) qty+=o->GetRemainingQuantity();
-            out.emplace_back(p,qty);
+    void AdoptFar() {
+        for (auto it = far_.begin(); it != far_.end();) {
+            if (!InRange(it->first)) { ++it; continue; }
+            const size_t i = Index(it->first);
+            levels_[i] = std::move(it->second); Set(i);
+            if (count_++ == 0 || IsBetter<S>(it->first, best_)) best_ = it->first;
+            it = far_.erase(it);
         }
-        return out;
     }
+};
 
-    std::vector<std::pair<Price,uint64_t>> GetAskLevels(size_t depth=5) const {
-        std::scoped_lock lock(mutex_);
-        std::vector<std::pair<Price,uint64_t>> out; out.reserve(depth);
-        for (const auto& [p,lvl]: asks_) {
-            if(out.size()>=depth) break;
-            uint64_t qty=0; for(auto& o:lvl) qty+=o->GetRemainingQuantity();
-            out.emplace_back(p,qty);
+// ----- FlatSide -----
+// levels in one sorted contiguous array (a single-node B-tree), ordered worst..best so the touch
+// sits at back() and consuming it is a pop_back; binary search for inserts away from the touch
+template<Side S>
+class FlatSide {
+public:
+    PriceLevel& Insert(Price p) {
+        auto it = LowerBound(p);
+        if (it != levels_.end() && it->first == p) return it->second;
+        return levels_.emplace(it, p, PriceLevel{})->second;
+    }
+    void Erase(Price p) { auto it = LowerBound(p); if (it != levels_.end() && it->first == p) levels_.erase(it); }
+    PriceLevel* Find(Price p) { return const_cast<PriceLevel*>(std::as_const(*this).Find(p)); }
+    const PriceLevel* Find(Price p) const {
+        auto it = std::lower_bound(levels_.begin(), levels_.end(), p, [](const auto& lvl, Price x) { return IsBetter<S>(x, lvl.first); });
+        return it != levels_.end() && it->first == p ? &it->second : nullptr;
+    }
+
+    LevelRef Best() { if (levels_.empty()) return {}; auto& [p, lvl] = levels_.back(); return {p, &lvl}; }
+    LevelRef NextBest(Price p) { auto it = LowerBound(p); if (it == levels_.begin()) return {}; --it; return {it->first, &it->second}; }
+    LevelRef Worst() { if (levels_.empty()) return {}; auto& [p, lvl] = levels_.front(); return {p, &lvl}; }
+    Price BestPrice() const { return levels_.back().first; }
+
+    bool Empty() const { return levels_.empty(); }
+    size_t LevelCount() const { return levels_.size(); }
+
+    template<class F> void ForEach(F&& visit) const { for (auto it = levels_.rbegin(); it != levels_.rend(); ++it) if (!visit(it->first, it->second)) return; }
+    template<class F> void ForEachTo(Price limit, F&& visit) const {
+        for (auto it = levels_.rbegin(); it != levels_.rend(); ++it) { if (IsBetter<S>(limit, it->first) || !visit(it->first, it->second)) return; }
+    }
+
+private:
+    std::vector<std::pair<Price, PriceLevel>> levels_;
+
+    // first level not worse than p
+    auto LowerBound(Price p) {
+        return std::lower_bound(levels_.begin(), levels_.end(), p, [](const auto& lvl, Price x) { return IsBetter<S>(x, lvl.first); });
+    }
+};
+
+// ----- SkipListSide -----
+// probabilistic ordered list of levels, best first; the touch is head.next[0] and node addresses
+// are stable, at the cost of one allocation per new level
+template<Side S>
+class SkipListSide {
+public:
+    SkipListSide() = default;
+    SkipListSide(const SkipListSide&) = delete;
+    SkipListSide& operator=(const SkipListSide&) = delete;
+    ~SkipListSide() { for (Node* n = head_.next[0]; n;) { Node* next = n->next[0]; delete n; n = next; } }
+
+    PriceLevel& Insert(Price p) {
+        Node* update[MaxHeight];
+        Node* x = Seek(p, update);
+        if (x && x->price == p) return x->level;
+        const int h = RandomHeight();
+        for (int i = height_; i < h; ++i) update[i] = &head_;
+        height_ = std::max(height_, h);
+        Node* n = new Node{p, PriceLevel{}, h, {}};
+        for (int i = 0; i < h; ++i) { n->next[i] = update[i]->next[i]; update[i]->next[i] = n; }
+        ++count_;
+        return n->level;
+    }
+
+    void Erase(Price p) {
+        Node* update[MaxHeight];
+        Node* x = Seek(p, update);
+        if (!x || x->price != p) return;
+        for (int i = 0; i < x->height; ++i) update[i]->next[i] = x->next[i];
+        delete x;
+        while (height_ > 1 && !head_.next[height_ - 1]) --height_;
+        --count_;
+    }
+
+    PriceLevel* Find(Price p) { Node* x = Seek(p, nullptr); return x && x->price == p ? &x->level : nullptr; }
+    const PriceLevel* Find(Price p) const {
+        const Node* x = &head_;
+        for (int i = height_ - 1; i >= 0; --i) while (x->next[i] && IsBetter<S>(x->next[i]->price, p)) x = x->next[i];
+        x = x->next[0];
+        return x && x->price == p ? &x->level : nullptr;
+    }
+
+    LevelRef Best() { return RefOf(head_.next[0]); }
+    LevelRef NextBest(Price p) { Node* x = Seek(p, nullptr); if (x && x->price == p) x = x->next[0]; return RefOf(x); }
+    LevelRef Worst() {
+        Node* x = &head_;
+        for (int i = height_ - 1; i >= 0; --i) while (x->next[i]) x = x->next[i];
+        return x == &head_ ? LevelRef{} : RefOf(x);
+    }
+    Price BestPrice() const { return head_.next[0]->price; }
+
+    bool Empty() const { return count_ == 0; }
+    size_t LevelCount() const { return count_; }
+
+    template<class F> void ForEach(F&& visit) const { for (const Node* n = head_.next[0]; n; n = n->next[0]) if (!visit(n->price, n->level)) return; }
+    template<class F> void ForEachTo(Price limit, F&& visit) const {
+        for (const Node* n = head_.next[0]; n; n = n->next[0]) { if (IsBetter<S>(limit, n->price) || !visit(n->price, n->level)) return; }
+    }
+
+private:
+    static constexpr int MaxHeight = 16;
+    struct Node { Price price; PriceLevel level; int height; Node* next[MaxHeight]; };
+
+    Node head_{0, {}, MaxHeight, {}};
+    int height_ = 1;
+    size_t count_ = 0;
+    uint64_t rng_ = 0x9E3779B97F4A7C15ull;
+
+    // first node not better than p; fills update[] with the last node before it on each level
+    Node* Seek(Price p, Node** update) {
+        Node* x = &head_;
+        for (int i = height_ - 1; i >= 0; --i) {
+            while (x->next[i] && IsBetter<S>(x->next[i]->price, p)) x = x->next[i];
+            if (update) update[i] = x;
         }
-        return out;
+        return x->next[0];
     }
 
-    size_t Size() const { std::scoped_lock lock(mutex_); return orders_.size(); }
+    // geometric(1/2) heights from a xorshift stream
+    int RandomHeight() {
+        rng_ ^= rng_ << 13; rng_ ^= rng_ >> 7; rng_ ^= rng_ << 17;
+        return 1 + std::countr_zero(rng_ | (uint64_t{1} << (MaxHeight - 1)));
+    }
+
+    static LevelRef RefOf(Node* n) { return n ? LevelRef{n->price, &n->level} : LevelRef{}; }
+};
+
+// ----- HybridSide -----
+// a fixed 64-tick window anchored just behind the touch lives in a contiguous array with a
+// one-word occupancy mask; everything deeper sits in an ordered tree. The window slides as the
+// touch moves, demoting levels that fall off its deep end and promoting tree levels that come
+// into range, so matching and top-of-book work stays in a few cache lines while far-away orders
+// cost one tree node each instead of ladder slots.
+template<Side S>
+class HybridSide {
+public:
+    PriceLevel& Insert(Price p) {
+        const int64_t k = Key(p);
+        if (Empty()) k0_ = k - Headroom;
+        else if (k < k0_) Reanchor(k - Headroom); // touch improved past the window
+        if (k >= k0_ + int64_t(Window)) return deep_[p];
+        const int i = int(k - k0_);
+        bits_ |= uint64_t{1} << i;
+        return window_[i];
+    }
+
+    void Erase(Price p) {
+        const int64_t k = Key(p);
+        if (k < k0_ || k >= k0_ + int64_t(Window)) { deep_.erase(p); return; }
+        const int i = int(k - k0_);
+        if (!(bits_ >> i & 1)) return;
+        bits_ &= ~(uint64_t{1} << i); window_[i] = PriceLevel{};
+        // keep the touch near the front of the window; the window is only empty when the side is
+        if (!bits_) { if (!deep_.empty()) Reanchor(Key(deep_.begin()->first) - Headroom); }
+        else if (std::countr_zero(bits_) > int(Window / 2) && !deep_.empty()) Reanchor(k0_ + std::countr_zero(bits_) - Headroom);
+    }
+
+    PriceLevel* Find(Price p) { return const_cast<PriceLevel*>(std::as_const(*this).Find(p)); }
+    const PriceLevel* Find(Price p) const {
+        const int64_t k = Key(p);
+        if (k < k0_) return nullptr;
+        if (k >= k0_ + int64_t(Window)) { auto it = deep_.find(p); return it == deep_.end() ? nullptr : &it->second; }
+        const int i = int(k - k0_);
+        return bits_ >> i & 1 ? &window_[i] : nullptr;
+    }
+
+    LevelRef Best() { return bits_ ? SlotRef(std::countr_zero(bits_)) : LevelRef{}; }
+    LevelRef NextBest(Price p) {
+        const int64_t k = Key(p) + 1 - k0_; // first slot strictly worse than p
+        if (k < int64_t(Window)) {
+            const uint64_t rest = k <= 0 ? bits_ : bits_ & (~uint64_t{0} << k);
+            if (rest) return SlotRef(std::countr_zero(rest));
+        }
+        auto it = deep_.upper_bound(p);
+        return it == deep_.end() ? LevelRef{} : LevelRef{it->first, &it->second};
+    }
+    LevelRef Worst() {
+        if (!deep_.empty()) { auto& [p, lvl] = *deep_.rbegin(); return {p, &lvl}; }
+        return bits_ ? SlotRef(63 - std::countl_zero(bits_)) : LevelRef{};
+    }
+    Price BestPrice() const { return PriceOf(k0_ + std::countr_zero(bits_)); }
+
+    bool Empty() const { return bits_ == 0; }
+    size_t LevelCount() const { return size_t(std::popcount(bits_)) + deep_.size(); }
+
+    template<class F> void ForEach(F&& visit) const {
+        for (uint64_t b = bits_; b; b &= b - 1) { const int i = std::countr_zero(b); if (!visit(PriceOf(k0_ + i), window_[i])) return; }
+        for (const auto& [p, lvl] : deep_) if (!visit(p, lvl)) return;
+    }
+    template<class F> void ForEachTo(Price limit, F&& visit) const {
+        ForEach([&](Price p, const PriceLevel& lvl) { return !IsBetter<S>(limit, p) && visit(p, lvl); });
+    }
 
 private:
-    mutable std::mutex mutex_;
-    std::condition_variable cv_;
-    std::atomic<bool> shutdown_;
-    std::thread pruneThread_; // background pruning thread
+    static constexpr size_t Window = 64;   // one occupancy word
+    static constexpr int64_t Headroom = 8; // slots kept free in front of the touch after a slide
+    using Compare = std::conditional_t<S == Side::Buy, std::greater<Price>, std::less<Price>>;
 
-    std::map<Price,OrderPointers,std::greater<Price>> bids_; // buy sides descending
-    std::map<Price,OrderPointers,std::less<Price>> asks_; // sell sides ascending
-    std::unordered_map<OrderId,OrderEntry> orders_;
-    std::map<Price,LevelData,std::greater<Price>> data_;
+    std::array<PriceLevel, Window> window_;
+    uint64_t bits_ = 0;  // bit i set <=> window_[i] is live
+    int64_t k0_ = 0;     // key of window_[0]
+    std::map<Price, PriceLevel, Compare> deep_; // invariant: every key >= k0_ + Window
 
-    // bookkeeping hooks
-    void OnOrderAdded(const OrderPtr& order){ auto &ld=data_[order->GetPrice()]; ld.count++; ld.quantity+=order->GetInitialQuantity(); }
-    void OnOrderCancelled(const OrderPtr& order){ auto it=data_.find(order->GetPrice()); if(it!=data_.end()){ it->second.count--; it->second.quantity-=order->GetRemainingQuantity(); if(it->second.count==0) data_.erase(it); } }
-    void OnOrderMatched(Price price, Quantity qty, bool full){ auto it=data_.find(price); if(it==data_.end()) return; if(full) it->second.count--; it->second.quantity-=qty; if(it->second.count==0) data_.erase(it); }
+    // distance-from-touch ordering: smaller key is a better price on either side
+    static int64_t Key(Price p) { if constexpr (S == Side::Buy) return -int64_t(p); else return int64_t(p); }
+    static Price PriceOf(int64_t k) { if constexpr (S == Side::Buy) return Price(-k); else return Price(k); }
+    LevelRef SlotRef(int i) { return {PriceOf(k0_ + i), &window_[i]}; }
 
-    // matching helpers
-    bool CanMatch(Side side, Price price) const {
-        if(side==Side::Buy){ if(asks_.empty()) return false; return price>=asks_.begin()->first; }
-        else{ if(bids_.empty()) return false; return price<=bids_.begin()->first; }
+    // move the window to start at key k0 (nothing may be live in front of it); slots are shifted
+    // in place in the direction that never overwrites a live level, vacated slots left empty
+    void Reanchor(int64_t k0) {
+        const int64_t delta = k0 - k0_;
+        uint64_t bits = 0;
+        auto shift = [&](int i) {
+            const int64_t j = i - delta;
+            if (j >= int64_t(Window)) deep_.emplace(PriceOf(k0_ + i), std::exchange(window_[i], PriceLevel{}));
+            else { if (j != i) window_[j] = std::exchange(window_[i], PriceLevel{}); bits |= uint64_t{1} << j; }
+        };
+        if (delta > 0) for (uint64_t b = bits_; b; b &= b - 1) shift(std::countr_zero(b));
+        else for (uint64_t b = bits_; b; b &= ~(uint64_t{1} << (63 - std::countl_zero(b)))) shift(63 - std::countl_zero(b));
+        while (!deep_.empty() && Key(deep_.begin()->first) < k0 + int64_t(Window)) {
+            const int64_t j = Key(deep_.begin()->first) - k0;
+            window_[j] = std::move(deep_.begin()->second); bits |= uint64_t{1} << j;
+            deep_.erase(deep_.begin());
+        }
+        bits_ = bits; k0_ = k0;
     }
+};
 
-    bool CanFullyFill(Side side, Price price, Quantity qty) const {
-        if(!CanMatch(side,price)) return false;
-        uint64_t remaining=qty;
-        if(side==Side::Buy){
-            for(auto& [p,lvl]: asks_){
-                if(p>price) break;
-                auto dit=data_.find(p);
-                uint64_t avail=(dit!=data_.end())?dit->second.quantity:0;
-                if(avail>=remaining) return true;
-                if(avail>0) remaining-=std::min<uint64_t>(avail,remaining);
-                if(remaining==0) return true;
-            }
-            return false;
-        } else {
-            for(auto& [p,lvl]: bids_){
-                if(p<price) break;
-                auto dit=data_.find(p);
-                uint64_t avail=(dit!=data_.end())?dit->second.quantity:0;
-                if(avail>=remaining) return true;
-                if(avail>0) remaining-=std::min<uint64_t>(avail,remaining);
-                if(remaining==0) return true;
+// ----- SeqLock -----
+// single-writer publication of a small trivially-copyable value. Readers never block the writer;
+// they retry if a store was in flight. The payload is held in atomic words so concurrent
+// reads are well-defined.
+template<class T>
+    requires std::is_trivially_copyable_v<T> && std::is_default_constructible_v<T>
+class SeqLock {
+public:
+    void Store(const T& value) noexcept {
+        uint64_t words[Words]{};
+        std::memcpy(words, &value, sizeof(T));
+        const uint64_t seq = seq_.load(std::memory_order_relaxed);
+        seq_.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < Words; ++i) data_[i].store(words[i], std::memory_order_relaxed);
+        seq_.store(seq + 2, std::memory_order_release);
+    }
+
+    T Load() const noexcept {
+        uint64_t words[Words];
+        uint64_t before, after;
+        do {
+            before = seq_.load(std::memory_order_acquire);
+            for (size_t i = 0; i < Words; ++i) words[i] = data_[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = seq_.load(std::memory_order_relaxed);
+        } while ((before & 1) || before != after);
+        T value;
+        std::memcpy(&value, words, sizeof(T));
+        return value;
+    }
+
+    // number of completed stores
+    uint64_t Version() const noexcept { return seq_.load(std::memory_order_acquire) / 2; }
+
+private:
+    static constexpr size_t Words = (sizeof(T) + 7) / 8;
+    std::atomic<uint64_t> seq_{0};
+    std::array<std::atomic<uint64_t>, Words> data_{};
+};
+
+// ----- bars -----
+struct Bar {
+    int64_t start = 0;    // interval start, ns since epoch
+    Price open = 0, high = 0, low = 0, close = 0;
+    uint64_t volume = 0;
+    int64_t notional = 0; // sum of price * quantity
+    uint32_t trades = 0;
+    double Vwap() const { return volume ? double(notional) / double(volume) : 0.0; }
+};
+
+// OHLCV/VWAP bars for one interval, fed from the matching thread in O(1) per trade. The open bar
+// and a ring of the most recent closed bars are published through SeqLocks, so any thread can
+// read them without the book lock. Intervals without trades produce no bar, and the open bar
+// is only closed by the first trade of a later interval. Trades are bucketed by the time of the
+// command that made them, not the wall clock, so a replayed or backup book builds the same bars.
+class BarAggregator {
+public:
+    explicit BarAggregator(std::chrono::nanoseconds interval, size_t history = 64)
+        : interval_(interval.count()), history_(history) {}
+
+    void OnTrade(Price price, Quantity qty, int64_t atNs) noexcept {
+        const int64_t start = atNs - atNs % interval_;
+        if (bar_.trades == 0 || start != bar_.start) {
+            if (bar_.trades) {
+                const uint64_t closed = closed_.load(std::memory_order_relaxed);
+                history_[closed % history_.size()].Store(bar_);
+                closed_.store(closed + 1, std::memory_order_release);
             }
-            return false;
+            bar_ = Bar{start, price, price, price, price, 0, 0, 0};
         }
+        bar_.high = std::max(bar_.high, price);
+        bar_.low = std::min(bar_.low, price);
+        bar_.close = price;
+        bar_.volume += qty;
+        bar_.notional += int64_t(price) * qty;
+        bar_.trades++;
+        current_.Store(bar_);
     }
 
-    std::vector<Trade> MatchOrders() {
-        std::vector<Trade> trades; trades.reserve(orders_.size());
-        while(!bids_.empty() && !asks_.empty()){
-            auto &[bidPrice,bids]=*bids_.begin(); auto &[askPrice,asks]=*asks_.begin();
-            if(bidPrice<askPrice) break;
-            while(!bids.empty() && !asks.empty()){
-                auto bid=bids.front(), ask=asks.front();
-                Quantity qty=std::min(bid->GetRemainingQuantity(),ask->GetRemainingQuantity());
-                bid->Fill(qty); ask->Fill(qty);
-                trades.emplace_back(Trade{TradeInfo{bid->GetOrderId(),askPrice,qty},TradeInfo{ask->GetOrderId(),askPrice,qty}});
-                OnOrderMatched(bidPrice,qty,bid->IsFilled()); OnOrderMatched(askPrice,qty,ask->IsFilled());
-                if(bid->IsFilled()){ orders_.erase(bid->GetOrderId()); bids.pop_front(); }
-                if(ask->IsFilled()){ orders_.erase(ask->GetOrderId()); asks.pop_front(); }
+    std::chrono::nanoseconds Interval() const { return std::chrono::nanoseconds(interval_); }
+
+    // the bar still accumulating (trades == 0 until the first trade)
+    Bar Current() const noexcept { return current_.Load(); }
+
+    // back = 0 is the most recently closed bar; empty once it has aged out of the ring
+    std::optional<Bar> Closed(size_t back) const noexcept {
+        const uint64_t closed = closed_.load(std::memory_order_acquire);
+        if (back >= closed || back >= history_.size()) return std::nullopt;
+        return history_[(closed - 1 - back) % history_.size()].Load();
+    }
+
+private:
+    int64_t interval_;
+    Bar bar_;  // writer's working copy
+    SeqLock<Bar> current_;
+    std::vector<SeqLock<Bar>> history_;
+    std::atomic<uint64_t> closed_{0};
+};
+
+// ----- sweep estimates -----
+// outcome of walking the opposite side as a hypothetical aggressor would
+struct SweepEstimate {
+    uint64_t quantity = 0;    // fillable quantity, at most the requested quantity
+    double averagePrice = 0;  // volume-weighted fill price; 0 when nothing fills
+    Price worstPrice = 0;     // price of the last level touched
+    uint32_t levels = 0;      // levels touched, the last one possibly only partially
+    bool operator==(const SweepEstimate&) const = default;
+};
+
+// the best few levels of each side as (price, resting quantity), published for lock-free estimates
+struct BookDepth {
+    static constexpr size_t Levels = 16;
+    struct Level { Price price = 0; uint64_t quantity = 0; };
+    std::array<Level, Levels> bids{}, asks{};
+    uint8_t bidLevels = 0, askLevels = 0;
+    bool bidsTruncated = false, asksTruncated = false; // the side has more levels than shown
+};
+
+// ----- top of book -----
+// touch plus book-shape signals, republished after every book change and read lock-free
+struct TopOfBook {
+    Price bidPrice = 0, askPrice = 0;        // meaningful only when the matching quantity is non-zero
+    uint64_t bidQuantity = 0, askQuantity = 0;
+    uint64_t bidDepth = 0, askDepth = 0;     // resting quantity within depthBps of each side's touch
+    double imbalance = 0;                    // (bidQty - askQty) / (bidQty + askQty) at the touch
+    double microprice = 0;                   // touch prices weighted by the opposite quantity; 0 if a side is empty
+    uint32_t depthBps = 0;
+    bool operator==(const TopOfBook&) const = default;
+};
+
+// ----- conflated feed -----
+// latest state of one level; count == 0 means the level has gone
+struct LevelUpdate { Side side; Price price; LevelData data; };
+
+// levels changed since they were last handed on, latest state only. Each side keeps one bit per
+// price in a window that re-centres on the first price marked after a clear; the rare price
+// outside the window goes to a map, like HybridSide's deep levels.
+class DirtyLevels {
+public:
+    void Mark(Side side, Price price, LevelData data) { (side == Side::Buy ? bids_ : asks_).Mark(price, data); }
+    void Merge(const DirtyLevels& other) {
+        other.ForEach([this](const LevelUpdate& u) { Mark(u.side, u.price, u.data); });
+    }
+    template<class F> void ForEach(F&& visit) const { bids_.ForEach(Side::Buy, visit); asks_.ForEach(Side::Sell, visit); }
+    size_t Size() const noexcept { return bids_.Size() + asks_.Size(); }
+    void Clear() noexcept { bids_.Clear(); asks_.Clear(); }
+
+private:
+    class Window {
+    public:
+        static constexpr size_t Span = 1024;
+
+        void Mark(Price p, LevelData d) {
+            if (size_ == 0) {
+                if (bits_.empty()) { bits_.resize(Span / 64); data_.resize(Span); } // books that never publish pay nothing
+                base_ = int64_t(p) - int64_t(Span / 2);
             }
-            if(bids.empty()){ bids_.erase(bidPrice); data_.erase(bidPrice); }
-            if(asks.empty()){ asks_.erase(askPrice); data_.erase(askPrice); }
+            const int64_t i = int64_t(p) - base_;
+            if (i < 0 || i >= int64_t(Span)) { size_ += far_.insert_or_assign(p, d).second; return; }
+            uint64_t& word = bits_[size_t(i) >> 6];
+            size_ += !(word & (1ull << (i & 63)));
+            word |= 1ull << (i & 63);
+            data_[size_t(i)] = d;
         }
-        if(!bids_.empty() && !bids_.begin()->second.empty() && bids_.begin()->second.front()->GetOrderType()==OrderType::FillAndKill)
-            CancelOrderInternal(bids_.begin()->second.front()->GetOrderId());
-        if(!asks_.empty() && !asks_.begin()->second.empty() && asks_.begin()->second.front()->GetOrderType()==OrderType::FillAndKill)
-            CancelOrderInternal(asks_.begin()->second.front()->GetOrderId());
-        return trades;
+        template<class F> void ForEach(Side side, F& visit) const {
+            for (size_t w = 0; w < bits_.size(); ++w)
+                for (uint64_t m = bits_[w]; m; m &= m - 1) {
+                    const size_t i = w * 64 + std::countr_zero(m);
+                    visit(LevelUpdate{side, Price(base_ + int64_t(i)), data_[i]});
+                }
+            for (const auto& [p, d] : far_) visit(LevelUpdate{side, p, d});
+        }
+        size_t Size() const noexcept { return size_; }
+        void Clear() noexcept { if (size_) { std::fill(bits_.begin(), bits_.end(), 0); far_.clear(); size_ = 0; } }
+
+    private:
+        size_t size_ = 0;
+        int64_t base_ = 0;
+        std::vector<uint64_t> bits_;
+        std::vector<LevelData> data_;
+        std::map<Price, LevelData> far_;
+    };
+
+    Window bids_, asks_;
+};
+
+// what a consumer gets from one Poll: every level that changed since its previous poll, once,
+// with its current state, and the top of book if that changed. Applied in order, the updates leave
+// a copy of the book as it was at `sequence`
+struct ConflatedUpdate {
+    std::vector<LevelUpdate> levels;
+    std::optional<TopOfBook> top;
+    uint64_t sequence = 0; // book publication this brings the consumer up to
+};
+
+// one consumer's view of a book, double-buffered. The matching thread merges each change into the
+// active buffer and never waits; Poll flips the active buffer and, if a merge into the one it just
+// retired is still in flight, waits for that merge alone. However far behind the consumer falls,
+// a buffer holds at most one entry per price, so a slow reader costs memory bounded by the book's
+// span rather than by its lag.
+class ConflatingFeed {
+public:
+    explicit ConflatingFeed(uint64_t joinedAt) : joinedAt_(joinedAt), delivered_(joinedAt) {}
+
+    // consumer side: false if nothing changed since the last poll
+    bool Poll(ConflatedUpdate& out) {
+        out.levels.clear(); out.top.reset();
+        Pending& taken = pending_[active_.fetch_xor(1)];
+        while (writing_.load()) std::this_thread::yield();
+        taken.levels.ForEach([&](const LevelUpdate& u) { out.levels.push_back(u); });
+        if (taken.topChanged) out.top = taken.top;
+        if (taken.sequence) delivered_ = taken.sequence;
+        out.sequence = delivered_;
+        taken.levels.Clear(); taken.topChanged = false; taken.sequence = 0;
+        return !out.levels.empty() || out.top;
+    }
+
+    // book publication current when the feed was attached; every later change reaches the feed
+    uint64_t JoinedAt() const noexcept { return joinedAt_; }
+
+    // publisher side, called by the book under its lock after each change
+    void Publish(const DirtyLevels& changed, const TopOfBook& top, uint64_t sequence) noexcept {
+        writing_.store(true);
+        Pending& p = pending_[active_.load()];
+        p.levels.Merge(changed);
+        if (top != lastTop_) { p.top = lastTop_ = top; p.topChanged = true; }
+        p.sequence = sequence;
+        writing_.store(false);
+    }
+
+private:
+    struct Pending { DirtyLevels levels; TopOfBook top; bool topChanged = false; uint64_t sequence = 0; };
+    std::array<Pending, 2> pending_;
+    std::atomic<uint32_t> active_{0};  // buffer the publisher merges into
+    std::atomic<bool> writing_{false}; // a merge is in flight
+    TopOfBook lastTop_;                // publisher-only
+    uint64_t joinedAt_, delivered_;    // delivered_ is consumer-only
+};
+
+// ----- SPSC ring -----
+// bounded single-producer single-consumer queue; neither side blocks, allocates or makes a syscall.
+// Each side caches the other's index and rereads it only when the ring looks full or empty.
+template<class T, size_t N>
+    requires (std::has_single_bit(N) && std::is_trivially_copyable_v<T>)
+class SpscRing {
+public:
+    // producer side
+    bool TryPush(const T& value) noexcept {
+        const uint64_t head = head_.load(std::memory_order_relaxed);
+        if (head - tailCache_ == N) {
+            tailCache_ = tail_.load(std::memory_order_acquire);
+            if (head - tailCache_ == N) return false;
+        }
+        slots_[head & (N - 1)] = value;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+    size_t Free() noexcept {
+        tailCache_ = tail_.load(std::memory_order_acquire);
+        return N - size_t(head_.load(std::memory_order_relaxed) - tailCache_);
+    }
+
+    // consumer side
+    bool TryPop(T& value) noexcept {
+        const uint64_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == headCache_) {
+            headCache_ = head_.load(std::memory_order_acquire);
+            if (tail == headCache_) return false;
+        }
+        value = slots_[tail & (N - 1)];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    alignas(64) std::atomic<uint64_t> head_{0};
+    uint64_t tailCache_ = 0; // producer-only
+    alignas(64) std::atomic<uint64_t> tail_{0};
+    uint64_t headCache_ = 0; // consumer-only
+    alignas(64) std::array<T, N> slots_{};
+};
+
+// ----- wire events -----
+// the book's outbound stream, one entry per changed level or trade, closed by a Publication entry
+// carrying the publication sequence. A publication goes into the ring whole or not at all; one that
+// does not fit is dropped and receivers see the gap in the sequence.
+struct WireEvent {
+    enum class Kind : uint8_t { Level, Trade, Publication };
+    Kind kind = Kind::Publication;
+    Side side = Side::Buy;  // the level's side, or the trade's aggressor
+    Price price = 0;
+    uint32_t count = 0;     // orders at the level
+    uint64_t quantity = 0;  // resting at the level, or traded
+    uint64_t sequence = 0;  // Trade::sequence, or the publication
+};
+using WireRing = SpscRing<WireEvent, 1 << 14>;
+
+// ----- decimal text -----
+// fixed-point <-> decimal text for gateway adapters (FIX, JSON), without strtod or std::format.
+// Digits are taken eight at a time with SWAR arithmetic on one 64-bit word (no SIMD intrinsics,
+// so the file stays portable; price strings rarely have more than 16 digits, which is two words)
+// and written two at a time from a digit-pair table.
+namespace detail {
+inline constexpr std::array<int64_t, 19> Pow10 = [] {
+    std::array<int64_t, 19> p{}; p[0] = 1;
+    for (size_t i = 1; i < p.size(); ++i) p[i] = p[i - 1] * 10;
+    return p;
+}();
+
+inline constexpr char DigitPairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+inline uint64_t LoadEight(const char* p) noexcept {
+    uint64_t word;
+    std::memcpy(&word, p, 8);
+    if constexpr (std::endian::native == std::endian::big) word = __builtin_bswap64(word);
+    return word;
+}
+
+// every byte of the little-endian word is '0'..'9'
+constexpr bool AllDigits(uint64_t word) noexcept {
+    return !(((word + 0x4646464646464646) | (word - 0x3030303030303030)) & 0x8080808080808080);
+}
+
+// value of eight ASCII digits, first character most significant
+constexpr uint32_t EightDigits(uint64_t word) noexcept {
+    word -= 0x3030303030303030;
+    word = word * 10 + (word >> 8);                                  // adjacent pairs
+    word = ((word & 0x000000FF000000FF) * 0x000F424000000064          // pairs to quads, quads to one
+            + ((word >> 16) & 0x000000FF000000FF) * 0x0000271000000001) >> 32;
+    return uint32_t(word);
+}
+
+// up to `limit` digits at p into value; returns how many were taken
+inline size_t TakeDigits(const char*& p, const char* end, size_t limit, int64_t& value) noexcept {
+    size_t taken = 0;
+    while (limit - taken >= 8 && end - p >= 8) {
+        const uint64_t word = LoadEight(p);
+        if (!AllDigits(word)) break;
+        value = value * 100000000 + EightDigits(word);
+        p += 8; taken += 8;
+    }
+    while (taken < limit && p != end && unsigned(*p - '0') < 10) { value = value * 10 + (*p++ - '0'); ++taken; }
+    return taken;
+}
+} // namespace detail
+
+// "[-]digits[.digits]" as an integer count of 10^-decimals units, exactly: fraction digits beyond
+// `decimals` must be zeros. Empty on anything else, or beyond 18 significant digits
+inline std::optional<int64_t> ParseFixed(std::string_view text, unsigned decimals) noexcept {
+    const char* p = text.data();
+    const char* const end = p + text.size();
+    const bool negative = p != end && *p == '-';
+    p += negative;
+    const char* const first = p;
+    while (p != end && *p == '0') ++p; // leading zeros carry nothing
+    int64_t value = 0;
+    const size_t whole = detail::TakeDigits(p, end, 18, value);
+    bool any = p != first;
+    size_t fraction = 0;
+    if (p != end && *p == '.') {
+        ++p;
+        const char* const digits = p;
+        if (whole + decimals > 18) return std::nullopt;
+        fraction = detail::TakeDigits(p, end, decimals, value);
+        while (p != end && *p == '0') ++p;
+        any |= p != digits;
+    }
+    if (!any || p != end || whole + decimals > 18) return std::nullopt;
+    value *= detail::Pow10[decimals - fraction];
+    return negative ? -value : value;
+}
+
+inline std::optional<Quantity> ParseQuantity(std::string_view text) noexcept {
+    const auto value = ParseFixed(text, 0);
+    if (!value || *value < 0 || *value > std::numeric_limits<Quantity>::max()) return std::nullopt;
+    return Quantity(*value);
+}
+
+// value / 10^decimals with exactly `decimals` fraction digits; out needs room for 21 characters.
+// Returns one past the last character written, like std::to_chars
+inline char* FormatFixed(char* out, int64_t value, unsigned decimals) noexcept {
+    assert(decimals <= 18);
+    char digits[20];
+    char* d = digits + sizeof(digits);
+    uint64_t u = value < 0 ? 0 - uint64_t(value) : uint64_t(value);
+    while (u >= 100) { d -= 2; std::memcpy(d, detail::DigitPairs + 2 * (u % 100), 2); u /= 100; }
+    if (u >= 10) { d -= 2; std::memcpy(d, detail::DigitPairs + 2 * u, 2); } else *--d = char('0' + u);
+    while (size_t(digits + sizeof(digits) - d) <= decimals) *--d = '0'; // at least one whole digit
+    const size_t count = size_t(digits + sizeof(digits) - d), whole = count - decimals;
+    if (value < 0) *out++ = '-';
+    std::memcpy(out, d, whole); out += whole;
+    if (decimals) { *out++ = '.'; std::memcpy(out, d + whole, decimals); out += decimals; }
+    return out;
+}
+
+// ----- instrument reference data -----
+// Price counts units of 10^-priceDecimals. From each band's `from` up to the next band, valid prices
+// step by that band's tick; quantities come in whole lots within [minQuantity, maxQuantity]. Specs
+// are literal types, so a table written as a constexpr variable is validated by the compiler (an
+// invalid one does not compile); built at run time from reference data it throws instead.
+struct TickBand { Price from; Price tick; };
+
+class InstrumentSpec {
+public:
+    static constexpr size_t MaxBands = 8;
+
+    constexpr InstrumentSpec(uint8_t priceDecimals, std::initializer_list<TickBand> ticks, Quantity lotSize = 1,
+                             Quantity minQuantity = 1, Quantity maxQuantity = std::numeric_limits<Quantity>::max())
+        : decimals_(priceDecimals), lot_(lotSize), minQuantity_(minQuantity), maxQuantity_(maxQuantity) {
+        if (ticks.size() == 0 || ticks.size() > MaxBands) throw std::invalid_argument("1 to MaxBands tick bands");
+        if (priceDecimals > 9) throw std::invalid_argument("at most 9 price decimals");
+        if (lotSize == 0 || minQuantity == 0 || minQuantity > maxQuantity) throw std::invalid_argument("bad lot or quantity limits");
+        for (const TickBand& band : ticks) {
+            if (band.tick <= 0) throw std::invalid_argument("tick must be positive");
+            if (count_ == 0 ? band.from != 0 : band.from <= bands_[count_ - 1].from) throw std::invalid_argument("bands must start at 0 and ascend");
+            // a boundary lies on both grids, so tick indices stay dense across it
+            if (band.from % band.tick || (count_ && band.from % bands_[count_ - 1].tick)) throw std::invalid_argument("band boundary off tick");
+            firstIndex_[count_] = count_ ? firstIndex_[count_ - 1] + (band.from - bands_[count_ - 1].from) / bands_[count_ - 1].tick : 0;
+            bands_[count_++] = band;
+        }
+    }
+
+    constexpr uint8_t PriceDecimals() const noexcept { return decimals_; }
+    constexpr Quantity LotSize() const noexcept { return lot_; }
+    constexpr Price TickAt(Price price) const noexcept { return bands_[Band(price)].tick; }
+
+    // None, OffTick or InvalidLot; `priced` is false for market orders
+    constexpr RejectReason Check(Price price, Quantity quantity, bool priced) const noexcept {
+        if (priced && price >= 0 && (price - bands_[Band(price)].from) % bands_[Band(price)].tick) return RejectReason::OffTick;
+        if (quantity % lot_ || quantity < minQuantity_ || quantity > maxQuantity_) return RejectReason::InvalidLot;
+        return RejectReason::None;
+    }
+
+    // position of a valid price among all valid prices (0 is price 0), and back: a dense index
+    // for tick-indexed structures whose tick varies by band
+    constexpr int64_t TickIndex(Price price) const noexcept {
+        const size_t b = Band(price);
+        return firstIndex_[b] + (int64_t(price) - bands_[b].from) / bands_[b].tick;
+    }
+    constexpr Price PriceAt(int64_t index) const noexcept {
+        size_t b = count_ - 1;
+        while (b > 0 && firstIndex_[b] > index) --b;
+        return Price(bands_[b].from + (index - firstIndex_[b]) * bands_[b].tick);
     }
 
-    void CancelOrderInternal(OrderId id){
-        if(!orders_.contains(id)) return;
-        auto entry=orders_.at(id); auto order=entry.order; auto it=entry.it;
-        orders_.erase(id);
-        if(order->GetSide()==Side::Sell){ auto &c=asks_.at(order->GetPrice()); c.erase(it); if(c.empty()) asks_.erase(order->GetPrice()); }
-        else{ auto &c=bids_.at(order->GetPrice()); c.erase(it); if(c.empty()) bids_.erase(order->GetPrice()); }
-        OnOrderCancelled(order);
+    // nearest valid price that does not improve on price for side: buys round down, sells up
+    constexpr Price RoundToTick(Price price, Side side) const noexcept {
+        const TickBand& band = bands_[Band(price)];
+        const Price off = (price - band.from) % band.tick;
+        if (off == 0) return price;
+        return side == Side::Buy ? price - off : price - off + band.tick;
     }
 
-    void PruneGoodForDayOrders(){
-        using namespace std::chrono; const int pruneHour=16;
-        while(!shutdown_.load()){
-            auto now=system_clock::now(); std::time_t now_c=system_clock::to_time_t(now);
-            std::tm local_tm{}; localtime_r(&now_c,&local_tm);
-            local_tm.tm_hour=pruneHour; local_tm.tm_min=0; local_tm.tm_sec=0;
-            auto next=system_clock::from_time_t(std::mktime(&local_tm));
-            if(next<=now) next+=hours(24); auto waitDuration=next-now+milliseconds(100);
-            std::unique_lock lk(mutex_);
-            if(cv_.wait_for(lk,waitDuration,[this]{ return shutdown_.load(); })) return;
-            std::vector<OrderId> toCancel; for(auto &[id,entry]: orders_) if(entry.order->GetOrderType()==OrderType::GoodForDay) toCancel.push_back(id);
-            for(auto id:toCancel) CancelOrderInternal(id);
+    // the decimal mantissa * 10^exponent as a price, exactly; empty if that needs more decimals
+    // than the instrument has or does not fit
+    constexpr std::optional<Price> ToPrice(int64_t mantissa, int exponent) const noexcept {
+        const int shift = exponent + decimals_;
+        if (shift < 0) {
+            if (shift < -18 || mantissa % detail::Pow10[-shift]) return std::nullopt;
+            mantissa /= detail::Pow10[-shift];
+        } else {
+            if (shift > 9 || mantissa > std::numeric_limits<Price>::max() / detail::Pow10[shift] || mantissa < std::numeric_limits<Price>::min() / detail::Pow10[shift]) return std::nullopt;
+            mantissa *= detail::Pow10[shift];
         }
+        if (mantissa > std::numeric_limits<Price>::max() || mantissa < std::numeric_limits<Price>::min()) return std::nullopt;
+        return Price(mantissa);
+    }
+
+    // decimal text straight to and from prices, e.g. in FIX and JSON adapters; ParsePrice does not
+    // check the tick grid (Check does, on add)
+    std::optional<Price> ParsePrice(std::string_view text) const noexcept {
+        const auto value = ParseFixed(text, decimals_);
+        if (!value || *value > std::numeric_limits<Price>::max() || *value < std::numeric_limits<Price>::min()) return std::nullopt;
+        return Price(*value);
+    }
+    char* FormatPrice(char* out, Price price) const noexcept { return FormatFixed(out, price, decimals_); }
+
+private:
+    std::array<TickBand, MaxBands> bands_{};
+    std::array<int64_t, MaxBands> firstIndex_{}; // TickIndex of each band's from
+    size_t count_ = 0;
+    uint8_t decimals_;
+    Quantity lot_, minQuantity_, maxQuantity_;
+
+    // bands are few, so a scan over all of them beats a search; prices below 0 use the first band
+    constexpr size_t Band(Price price) const noexcept {
+        size_t b = 0;
+        for (size_t i = 1; i < count_; ++i) b += price >= bands_[i].from;
+        return b;
     }
 };
 
-// ----- main -----
-#ifdef ORDERBOOK_SINGLE_MAIN
-int main(){
-    OrderBook ob;
-    auto o1=std::make_shared<Order>(OrderType::GoodTillCancel,1,Side::Buy,100,10);
-    auto o2=std::make_shared<Order>(OrderType::GoodTillCancel,2,Side::Sell,99,5);
-    auto trades=ob.AddOrder(o1); trades=ob.AddOrder(o2);
-    for(auto &t: trades) std::cout<<std::format("Trade: bid={} ask={} px={} qty={}\n", t.bid.orderId,t.ask.orderId,t.bid.price,t.bid.quantity);
-    std::cout<<"size: "<<ob.Size()<<"\n";
+// ----- price limits -----
+// price protection inside the book. A limit order priced more than bandBps from the reference is
+// rejected; a trade more than haltBps from the price the current window started at halts the book
+// instead of executing (reopen with SessionEvent::Open). The reference is the last trade, or
+// `reference` (e.g. the previous close) before the first one; the window restarts at the last
+// trade once `window` has passed, timed by the orders' own timestamps so replays halt alike.
+// 0 bps turns a check off
+struct PriceLimits {
+    Price reference = 0;
+    uint32_t bandBps = 0;
+    uint32_t haltBps = 0;
+    std::chrono::nanoseconds window = std::chrono::minutes(5);
+};
+
+// ----- OrderBook -----
+// Bids/Asks are any BookSide backend; OrderBook (std::map) is the reference the others are checked against
+template<template<Side> class SideT>
+    requires BookSide<SideT<Side::Buy>> && BookSide<SideT<Side::Sell>>
+class BasicOrderBook {
+public:
+    using OrderPtr = std::shared_ptr<Order>;
+    using OrderPointers = ::OrderPointers;
+    using Bids = SideT<Side::Buy>;
+    using Asks = SideT<Side::Sell>;
+    // prevOwned/nextOwned chain the entries of one owner; unordered_map nodes never move
+    struct OrderEntry { OrderPtr order; OrderPointers::iterator it; QueueMark mark; OrderEntry* prevOwned = nullptr; OrderEntry* nextOwned = nullptr; };
+
+    // a book owns no thread; session events, good-for-day expiry among them, arrive through
+    // ApplySessionEvent from whoever owns the book (see SessionScheduler). It starts in Continuous
+    BasicOrderBook() = default;
+
+    // add order; the trades it executed, or why it was rejected. The matching path below is
+    // noexcept end to end: contract violations are asserts, allocation failure terminates
+    OrderResult Submit(const OrderPtr& order) noexcept {
+        std::scoped_lock lock(mutex_);
+        auto result=SubmitInternal(order);
+        if(result.Accepted()) PublishTop(result.trades);
+        return result;
+    }
+
+    // cancel an order; a nonzero owner must own it
+    RejectReason Cancel(OrderId id, OwnerId owner = 0) noexcept {
+        std::scoped_lock lock(mutex_);
+        if(OwnedByOther(id, owner)) return RejectReason::NotPermitted;
+        if(!CancelOrderInternal(id)) return RejectReason::UnknownOrderId;
+        PublishTop();
+        return RejectReason::None;
+    }
+
+    // cancel then re-add with same type, atomically under one lock; owner as for Cancel. A replacement
+    // that could not rest is rejected before anything is cancelled, so a reject leaves the order as it was
+    OrderResult Modify(const OrderModify& mod, OwnerId owner = 0) noexcept {
+        std::scoped_lock lock(mutex_);
+        auto found = orders_.find(mod.GetOrderId());
+        if (found == orders_.end()) return Reject(RejectReason::UnknownOrderId);
+        if (owner && found->second.order->GetOwner() != owner) return Reject(RejectReason::NotPermitted);
+        const OrderType typeToKeep = found->second.order->GetOrderType();
+        const OwnerId ownerToKeep = found->second.order->GetOwner();
+        if (auto reason = CheckReplacement(typeToKeep, mod.GetPrice(), mod.GetQuantity()); reason != RejectReason::None) return Reject(reason);
+        CancelOrderInternal(mod.GetOrderId());
+        auto result=SubmitInternal(mod.ToOrderPointer(typeToKeep, ownerToKeep));
+        assert(result.Accepted()); // only resting types get here, and those cannot fail past the checks above
+        PublishTop(result.trades);
+        return result;
+    }
+
+    // cancel every resting order of one owner, e.g. when its session disconnects; walks only that
+    // owner's orders. Returns how many were cancelled
+    size_t CancelOwned(OwnerId owner) noexcept {
+        std::scoped_lock lock(mutex_);
+        size_t count=0;
+        for(auto head=owned_.find(owner); head!=owned_.end(); head=owned_.find(owner), ++count)
+            CancelOrderInternal(head->second->order->GetOrderId());
+        if(count) PublishTop();
+        return count;
+    }
+
+    // trade-only conveniences over Submit/Cancel/Modify
+    std::vector<Trade> AddOrder(const OrderPtr& order) { return Submit(order).trades; }
+    void CancelOrder(OrderId id) { Cancel(id); }
+    std::vector<Trade> ModifyOrder(const OrderModify& mod) { return Modify(mod).trades; }
+
+    // snapshot of top N levels (pass AllLevels for full depth)
+    static constexpr size_t AllLevels = std::numeric_limits<size_t>::max();
+
+    std::vector<std::pair<Price,uint64_t>> GetBidLevels(size_t depth=5) const {
+        std::scoped_lock lock(mutex_);
+        return Snapshot(bids_, depth);
+    }
+
+    std::vector<std::pair<Price,uint64_t>> GetAskLevels(size_t depth=5) const {
+        std::scoped_lock lock(mutex_);
+        return Snapshot(asks_, depth);
+    }
+
+    size_t Size() const { std::scoped_lock lock(mutex_); return orders_.size(); }
+
+    // order-by-order fingerprint of the resting book, maintained in O(1) per add, fill and cancel;
+    // books holding the same orders with the same remaining quantities hash equal
+    uint64_t StateHash() const noexcept { std::scoped_lock lock(mutex_); return stateHash_; }
+
+    // resting quantity ahead of this order in its level's time priority; empty if it is not resting
+    std::optional<uint64_t> QueueAhead(OrderId id) const noexcept {
+        std::scoped_lock lock(mutex_);
+        auto found=orders_.find(id);
+        if(found==orders_.end()) return std::nullopt;
+        const Order& order=*found->second.order;
+        const PriceLevel* lvl=order.GetSide()==Side::Buy ? bids_.Find(order.GetPrice()) : asks_.Find(order.GetPrice());
+        return lvl->queue.Ahead(found->second.mark);
+    }
+
+    // the same by walking the level's orders in front of this one; O(queue), the check on the counters above
+    std::optional<uint64_t> QueueAheadByWalk(OrderId id) const noexcept {
+        std::scoped_lock lock(mutex_);
+        auto found=orders_.find(id);
+        if(found==orders_.end()) return std::nullopt;
+        const Order& order=*found->second.order;
+        const PriceLevel* lvl=order.GetSide()==Side::Buy ? bids_.Find(order.GetPrice()) : asks_.Find(order.GetPrice());
+        uint64_t ahead=0;
+        for(auto it=lvl->orders.begin(); it!=found->second.it; ++it) ahead+=(*it)->GetRemainingQuantity();
+        return ahead;
+    }
+
+    // market impact of a hypothetical aggressive order of `side`, without touching any order or the book state.
+    // With PublishDepth on, walks within the published levels take no lock and see the last publication
+    SweepEstimate EstimateSweep(Side side, Quantity quantity) const noexcept {
+        return Estimate(side,side==Side::Buy ? std::numeric_limits<Price>::max() : std::numeric_limits<Price>::min(),quantity);
+    }
+
+    // everything an aggressor of `side` could take at prices up to (buy) / down to (sell) `price`
+    SweepEstimate QuantityToPrice(Side side, Price price) const noexcept {
+        return Estimate(side,price,std::numeric_limits<uint64_t>::max());
+    }
+
+    // republish the best BookDepth::Levels levels of each side after every change, for the lock-free
+    // estimates above; off by default since it costs every publication a walk of those levels
+    void PublishDepth(bool on) {
+        std::scoped_lock lock(mutex_);
+        if(on) depth_.Store(CaptureDepth());
+        publishDepth_.store(on,std::memory_order_release);
+    }
+
+    // touch, imbalance, microprice and depth-within-band as of the last book change; O(1), no lock
+    TopOfBook GetTopOfBook() const noexcept { return top_.Load(); }
+
+    // width of the depth band reported in TopOfBook, in basis points of each side's touch price
+    void SetDepthBand(uint32_t bps) {
+        std::scoped_lock lock(mutex_);
+        depthBps_=bps; bidBand_.live=askBand_.live=false;
+        PublishTop();
+    }
+
+    // cancel every good-for-day order now
+    void ExpireGoodForDay() noexcept { std::scoped_lock lock(mutex_); ExpireGoodForDayInternal(); PublishTop(); }
+
+    // a session transition, applied wherever the book's commands are; NotAllowedInSession, and
+    // nothing changed, unless SessionTransitions has it. Moving into Continuous or Closed first
+    // uncrosses whatever the auction or halt collected; Close and ExpireGoodForDay cancel
+    // good-for-day orders. Returns the uncross trades
+    OrderResult ApplySessionEvent(SessionEvent event, TimePoint at = std::chrono::system_clock::now()) noexcept {
+        std::scoped_lock lock(mutex_);
+        const auto next=StateAfter(state_,event);
+        if(!next) return Reject(RejectReason::NotAllowedInSession);
+        std::vector<Trade> trades;
+        if(*next!=state_ && (next==SessionState::Continuous || next==SessionState::Closed)) trades=UncrossInternal(at);
+        if(event==SessionEvent::Close || event==SessionEvent::ExpireGoodForDay) ExpireGoodForDayInternal();
+        state_=*next;
+        PublishTop(trades);
+        return OrderResult{std::move(trades), RejectReason::None};
+    }
+
+    SessionState GetSessionState() const noexcept { std::scoped_lock lock(mutex_); return state_; }
+
+    // validate adds against this instrument's tick and lot tables from now on (nullptr: no checks).
+    // Reference data outlives its books, so the book keeps only the pointer. Not a command: under a
+    // Sequencer, set through BookConfig so replays and backups see it too
+    void SetInstrument(const InstrumentSpec* spec) noexcept { std::scoped_lock lock(mutex_); instrument_=spec; }
+
+    // not a command: under a Sequencer, set through BookConfig so replays and backups see it too
+    void SetPriceLimits(const PriceLimits& limits) noexcept {
+        std::scoped_lock lock(mutex_);
+        limits_=limits;
+        RefreshLimits();
+    }
+
+    // dense serialized form of an idle book: a short header, then one fixed-size record per resting
+    // order, each level's queue in time priority. Empty if anything is attached (feeds, wires,
+    // bars), since those cannot be carried across. Restore on an empty book brings it back
+    std::optional<std::vector<uint8_t>> Hibernate() const {
+        std::scoped_lock lock(mutex_);
+        if(!feeds_.empty() || !wires_.empty() || !bars_.empty()) return std::nullopt;
+        const bool crossed=!bids_.Empty() && !asks_.Empty() && bids_.BestPrice()>=asks_.BestPrice();
+        DormantHeader header{DormantMagic, uint32_t(orders_.size()), executionSeq_, updateSeq_, depthBps_, 0, lastTradePrice_, uint8_t(state_), crossed, 0,
+                             limits_.reference, haltAnchor_, limits_.bandBps, limits_.haltBps, limits_.window.count(), haltAnchorTime_.time_since_epoch().count()};
+        std::vector<uint8_t> out(sizeof(header)+orders_.size()*sizeof(DormantOrder));
+        size_t at=sizeof(header);
+        auto save=[&](Price, const PriceLevel& lvl){
+            for(const auto& o: lvl.orders){
+                const DormantOrder d{o->GetOrderId(),o->GetTimestamp().time_since_epoch().count(),o->GetPrice(),o->GetInitialQuantity(),o->GetRemainingQuantity(),uint8_t(o->GetOrderType()),uint8_t(o->GetSide()),0,o->GetOwner(),0};
+                header.goodForDay+=o->GetOrderType()==OrderType::GoodForDay;
+                std::memcpy(out.data()+at,&d,sizeof(d)); at+=sizeof(d);
+            }
+            return true;
+        };
+        bids_.ForEach(save); asks_.ForEach(save);
+        std::memcpy(out.data(),&header,sizeof(header));
+        return out;
+    }
+
+    // false, and nothing changed, if this book is not empty or the bytes are not a hibernated book
+    bool Restore(std::span<const uint8_t> bytes) {
+        std::scoped_lock lock(mutex_);
+        DormantHeader header;
+        if(!orders_.empty() || bytes.size()<sizeof(header)) return false;
+        std::memcpy(&header,bytes.data(),sizeof(header));
+        if(header.magic!=DormantMagic || bytes.size()!=sizeof(header)+size_t(header.orders)*sizeof(DormantOrder)) return false;
+        for(size_t at=sizeof(header); at<bytes.size(); at+=sizeof(DormantOrder)){
+            DormantOrder d; std::memcpy(&d,bytes.data()+at,sizeof(d));
+            auto order=std::make_shared<Order>(OrderType(d.type),d.id,Side(d.side),d.price,d.initial,TimePoint(TimePoint::duration(d.timestamp)),d.owner);
+            order->Fill(d.initial-d.remaining);
+            Rest(order);
+        }
+        executionSeq_=header.executionSeq; updateSeq_=header.updateSeq; depthBps_=header.depthBps;
+        lastTradePrice_=header.lastTradePrice; state_=SessionState(header.state);
+        limits_=PriceLimits{header.reference,header.bandBps,header.haltBps,std::chrono::nanoseconds(header.windowNs)};
+        haltAnchor_=header.haltAnchor; haltAnchorTime_=TimePoint(TimePoint::duration(header.haltAnchorTime));
+        RefreshLimits();
+        bidBand_.live=askBand_.live=false;
+        PublishTop();
+        return true;
+    }
+
+    // a session event applied to a hibernated book in place, from its header alone. False, and
+    // nothing changed, if the event has orders to act on (an uncross or good-for-day purge), in
+    // which case the book has to be restored to apply it
+    static bool DormantApplySessionEvent(std::span<uint8_t> bytes, SessionEvent event) noexcept {
+        DormantHeader header;
+        if(bytes.size()<sizeof(header)) return false;
+        std::memcpy(&header,bytes.data(),sizeof(header));
+        if(header.magic!=DormantMagic) return false;
+        const auto next=StateAfter(SessionState(header.state),event);
+        if(!next) return true; // refused, as the live book would
+        const bool purge=event==SessionEvent::Close || event==SessionEvent::ExpireGoodForDay;
+        const bool uncross=uint8_t(*next)!=header.state && (next==SessionState::Continuous || next==SessionState::Closed);
+        if((purge && header.goodForDay) || (uncross && header.crossed)) return false;
+        header.state=uint8_t(*next);
+        std::memcpy(bytes.data(),&header,sizeof(header));
+        return true;
+    }
+
+    // a new conflating consumer; its first poll returns every current level unless withLevels is
+    // false, in which case the consumer seeds itself elsewhere (see RecoveryService) and the book
+    // does no per-level work for it. Call Unsubscribe when done
+    std::shared_ptr<ConflatingFeed> Subscribe(bool withLevels = true) {
+        std::scoped_lock lock(mutex_);
+        auto feed=std::make_shared<ConflatingFeed>(updateSeq_);
+        DirtyLevels all;
+        if(withLevels){
+            bids_.ForEach([&](Price p, const PriceLevel& lvl){ all.Mark(Side::Buy,p,lvl.data); return true; });
+            asks_.ForEach([&](Price p, const PriceLevel& lvl){ all.Mark(Side::Sell,p,lvl.data); return true; });
+        }
+        feed->Publish(all,top_.Load(),updateSeq_);
+        feeds_.push_back(feed);
+        return feed;
+    }
+
+    void Unsubscribe(const std::shared_ptr<ConflatingFeed>& feed) {
+        std::scoped_lock lock(mutex_);
+        std::erase(feeds_,feed);
+    }
+
+    // a ring carrying every publication from now on as wire events, for one consumer thread
+    std::shared_ptr<WireRing> OpenWire() {
+        std::scoped_lock lock(mutex_);
+        return wires_.emplace_back(std::make_shared<WireRing>());
+    }
+
+    void CloseWire(const std::shared_ptr<WireRing>& wire) {
+        std::scoped_lock lock(mutex_);
+        std::erase(wires_,wire);
+    }
+
+    // start maintaining bars at this interval; the aggregator lives as long as the book and is read lock-free
+    const BarAggregator& EnableBars(std::chrono::nanoseconds interval, size_t history = 64) {
+        std::scoped_lock lock(mutex_);
+        for (const auto& bars : bars_) if (bars->Interval() == interval) return *bars;
+        return *bars_.emplace_back(std::make_unique<BarAggregator>(interval, history));
+    }
+
+private:
+    mutable std::mutex mutex_;
+
+    Bids bids_; // buy sides, best (highest) first
+    Asks asks_; // sell sides, best (lowest) first
+    std::unordered_map<OrderId,OrderEntry> orders_;
+    std::unordered_map<OwnerId,OrderEntry*> owned_; // most recent resting order of each owner with any
+    uint64_t executionSeq_ = 0; // last Trade::sequence issued
+    uint64_t stateHash_ = 0;    // XOR of OrderHash over resting orders
+    Price lastTradePrice_ = 0;  // 0 until the first trade
+    SessionState state_ = SessionState::Continuous;
+
+    const InstrumentSpec* instrument_ = nullptr;
+
+    // limits_ turned into bounds once per change of reference, so the checks are plain compares
+    PriceLimits limits_;
+    Price haltAnchor_ = 0;      // trade price the current circuit-breaker window started at
+    TimePoint haltAnchorTime_{};
+    Price bandLo_ = std::numeric_limits<Price>::min(), bandHi_ = std::numeric_limits<Price>::max();
+    Price haltLo_ = std::numeric_limits<Price>::min(), haltHi_ = std::numeric_limits<Price>::max();
+    std::vector<std::unique_ptr<BarAggregator>> bars_; // one per enabled interval, fed after each sweep
+
+    // resting quantity at prices at least as good as limit, tracked by the level hooks while the
+    // touch stays put and rebuilt from the band's levels only when the touch moves
+    struct DepthBand { bool live = false; Price touch = 0; Price limit = 0; uint64_t quantity = 0; };
+    uint32_t depthBps_ = 10;
+    DepthBand bidBand_, askBand_;
+    SeqLock<TopOfBook> top_;
+    SeqLock<BookDepth> depth_;             // published only while publishDepth_
+    std::atomic<bool> publishDepth_{false};
+    std::vector<std::shared_ptr<ConflatingFeed>> feeds_;
+    std::vector<std::shared_ptr<WireRing>> wires_;
+    DirtyLevels changed_; // levels touched since the last publish, kept only while there are feeds or wires
+    uint64_t updateSeq_ = 0; // publications so far; stamps what feeds deliver
+
+    static constexpr uint32_t DormantMagic = 0x3448424f; // "OBH4"
+    struct DormantHeader {
+        uint32_t magic; uint32_t orders; uint64_t executionSeq, updateSeq; uint32_t depthBps, goodForDay;
+        Price lastTradePrice; uint8_t state; bool crossed; uint16_t pad = 0;
+        Price reference, haltAnchor; uint32_t bandBps, haltBps; int64_t windowNs, haltAnchorTime;
+    };
+    struct DormantOrder { OrderId id; int64_t timestamp; Price price; Quantity initial, remaining; uint8_t type, side; uint16_t pad = 0; OwnerId owner; uint32_t pad2 = 0; };
+    static_assert(sizeof(DormantHeader) == 72 && sizeof(DormantOrder) == 40, "records are copied as raw bytes, with no padding");
+
+    // order types each session state accepts, one bit per OrderType. Outside Continuous an order
+    // only rests until the next uncross, so only the resting types are accepted there
+    static constexpr uint8_t RestingTypes = 1u<<unsigned(OrderType::GoodTillCancel) | 1u<<unsigned(OrderType::GoodForDay);
+    static constexpr std::array<uint8_t,6> SessionOrderTypes{
+        0,            // Closed
+        RestingTypes, // PreOpen
+        RestingTypes, // OpeningAuction
+        0x1f,         // Continuous: everything
+        RestingTypes, // Halted: collected for the reopening uncross
+        RestingTypes, // ClosingAuction
+    };
+
+    static OrderResult Reject(RejectReason reason) noexcept { return OrderResult{{}, reason}; }
+
+    OrderResult SubmitInternal(const OrderPtr& order) noexcept {
+        if (state_ != SessionState::Continuous) [[unlikely]] return SubmitOutsideContinuous(order);
+        if (orders_.contains(order->GetOrderId())) return Reject(RejectReason::DuplicateOrderId);
+        if (order->GetInitialQuantity() == 0) return Reject(RejectReason::InvalidQuantity);
+        const bool priced = order->GetOrderType() != OrderType::Market;
+
+        // Market order conversion: convert into worst-price limit order
+        if (!priced) {
+            if (order->GetSide() == Side::Buy && !asks_.Empty()) order->ToGoodTillCancel(asks_.Worst().price);
+            else if (order->GetSide() == Side::Sell && !bids_.Empty()) order->ToGoodTillCancel(bids_.Worst().price);
+            else return Reject(RejectReason::NoLiquidity);
+        } else if (order->GetPrice() <= 0) {
+            return Reject(RejectReason::InvalidPrice);
+        } else if (order->GetPrice() < bandLo_ || order->GetPrice() > bandHi_) [[unlikely]] {
+            return Reject(RejectReason::OutsidePriceBand);
+        }
+        if (instrument_)
+            if (auto reason = instrument_->Check(order->GetPrice(), order->GetInitialQuantity(), priced); reason != RejectReason::None) return Reject(reason);
+
+        // FillAndKill / FillOrKill pre-checks; a FOK only counts what it can take short of the halt bounds
+        if (order->GetOrderType() == OrderType::FillAndKill &&
+            !CanMatch(order->GetSide(), order->GetPrice())) return Reject(RejectReason::FillAndKillNoMatch);
+        if (order->GetOrderType() == OrderType::FillOrKill &&
+            !CanFullyFill(order->GetSide(), order->GetSide() == Side::Buy ? std::min(order->GetPrice(), haltHi_) : std::max(order->GetPrice(), haltLo_),
+                          order->GetInitialQuantity())) return Reject(RejectReason::FillOrKillUnfillable);
+
+        Rest(order);
+
+        auto trades=order->GetSide()==Side::Buy ? MatchOrders<Side::Buy>() : MatchOrders<Side::Sell>();
+        if(!trades.empty()) RecordTrades(trades,order->GetTimestamp());
+        return OrderResult{std::move(trades), RejectReason::None};
+    }
+
+    // auction phases and halts: orders of the accepted types rest without matching
+    OrderResult SubmitOutsideContinuous(const OrderPtr& order) noexcept {
+        if (!(SessionOrderTypes[size_t(state_)] >> unsigned(order->GetOrderType()) & 1)) return Reject(RejectReason::NotAllowedInSession);
+        if (orders_.contains(order->GetOrderId())) return Reject(RejectReason::DuplicateOrderId);
+        if (order->GetInitialQuantity() == 0) return Reject(RejectReason::InvalidQuantity);
+        if (order->GetPrice() <= 0) return Reject(RejectReason::InvalidPrice);
+        if (order->GetPrice() < bandLo_ || order->GetPrice() > bandHi_) return Reject(RejectReason::OutsidePriceBand);
+        if (instrument_)
+            if (auto reason = instrument_->Check(order->GetPrice(), order->GetInitialQuantity(), true); reason != RejectReason::None) return Reject(reason);
+        Rest(order);
+        return {};
+    }
+
+    // the submit checks a resting limit order fails whatever else the book holds, in submit order
+    RejectReason CheckReplacement(OrderType type, Price price, Quantity quantity) const noexcept {
+        if (state_ != SessionState::Continuous && !(SessionOrderTypes[size_t(state_)] >> unsigned(type) & 1)) return RejectReason::NotAllowedInSession;
+        if (quantity == 0) return RejectReason::InvalidQuantity;
+        if (price <= 0) return RejectReason::InvalidPrice;
+        if (price < bandLo_ || price > bandHi_) return RejectReason::OutsidePriceBand;
+        return instrument_ ? instrument_->Check(price, quantity, true) : RejectReason::None;
+    }
+
+    void RecordTrades(std::span<const Trade> trades, TimePoint at) noexcept {
+        lastTradePrice_=trades.back().bid.price;
+        if(limits_.haltBps && at-haltAnchorTime_>=limits_.window){ haltAnchor_=lastTradePrice_; haltAnchorTime_=at; }
+        RefreshLimits();
+        if(!bars_.empty()) [[unlikely]] {
+            const int64_t atNs=std::chrono::duration_cast<std::chrono::nanoseconds>(at.time_since_epoch()).count();
+            for(const auto& t: trades) for(auto& bars: bars_) bars->OnTrade(t.bid.price,t.bid.quantity,atNs);
+        }
+    }
+
+    // queue the order at the back of its level
+    void Rest(const OrderPtr& order) noexcept {
+        PriceLevel& lvl = order->GetSide() == Side::Buy ? bids_.Insert(order->GetPrice()) : asks_.Insert(order->GetPrice());
+        if(lvl.queue.NeedsCompaction(lvl.data.count)) [[unlikely]] CompactQueue(lvl);
+        lvl.orders.push_back(order);
+        auto [entry, inserted] = orders_.insert({order->GetOrderId(), OrderEntry{order, std::prev(lvl.orders.end()), lvl.queue.Join(lvl.data.quantity)}});
+        if(order->GetOwner()) LinkOwned(entry->second);
+        OnOrderAdded(order->GetSide(), order->GetPrice(), lvl, order);
+    }
+
+    void LinkOwned(OrderEntry& entry) noexcept {
+        OrderEntry*& head=owned_[entry.order->GetOwner()];
+        entry.nextOwned=head;
+        if(head) head->prevOwned=&entry;
+        head=&entry;
+    }
+
+    void UnlinkOwned(OrderEntry& entry, OwnerId owner) noexcept {
+        if(entry.nextOwned) entry.nextOwned->prevOwned=entry.prevOwned;
+        if(entry.prevOwned) entry.prevOwned->nextOwned=entry.nextOwned;
+        else if(entry.nextOwned) owned_[owner]=entry.nextOwned;
+        else owned_.erase(owner);
+    }
+
+    // every removal from orders_ goes through here
+    void EraseEntry(std::unordered_map<OrderId,OrderEntry>::iterator found, OwnerId owner) noexcept {
+        if(owner) UnlinkOwned(found->second,owner);
+        orders_.erase(found);
+    }
+
+    // bookkeeping hooks, keep each level's aggregate in step with its orders
+    void OnOrderAdded(Side side, Price price, PriceLevel& lvl, const OrderPtr& order) noexcept { lvl.data.count++; lvl.data.quantity+=order->GetRemainingQuantity(); AdjustBand(side,price,int64_t(order->GetRemainingQuantity())); MarkChanged(side,price,lvl); stateHash_^=OrderHash(*order); }
+    void OnOrderCancelled(Side side, Price price, PriceLevel& lvl, const OrderPtr& order) noexcept { lvl.data.count--; lvl.data.quantity-=order->GetRemainingQuantity(); AdjustBand(side,price,-int64_t(order->GetRemainingQuantity())); MarkChanged(side,price,lvl); stateHash_^=OrderHash(*order); }
+    void OnOrderMatched(Side side, Price price, PriceLevel& lvl, const Order& order, Quantity qty) noexcept {
+        if(order.IsFilled()) lvl.data.count--;
+        lvl.data.quantity-=qty; lvl.queue.Fill(qty); AdjustBand(side,price,-int64_t(qty)); MarkChanged(side,price,lvl);
+        stateHash_^=OrderHash(order.GetOrderId(),price,side,order.GetRemainingQuantity()+qty)^OrderHash(order);
+    }
+    void MarkChanged(Side side, Price price, const PriceLevel& lvl) noexcept { if(!feeds_.empty() || !wires_.empty()) changed_.Mark(side,price,lvl.data); }
+
+    void RefreshLimits() noexcept {
+        auto bounds=[](Price reference, uint32_t bps){
+            if(!reference || !bps) return std::pair{std::numeric_limits<Price>::min(),std::numeric_limits<Price>::max()};
+            const int64_t width=int64_t(reference)*bps/10000;
+            return std::pair{Price(std::max<int64_t>(reference-width,1)),Price(std::min<int64_t>(reference+width,std::numeric_limits<Price>::max()))};
+        };
+        std::tie(bandLo_,bandHi_)=bounds(lastTradePrice_ ? lastTradePrice_ : limits_.reference,limits_.bandBps);
+        std::tie(haltLo_,haltHi_)=bounds(haltAnchor_ ? haltAnchor_ : limits_.reference,limits_.haltBps);
+    }
+
+    // Zobrist-style term for one resting order, XORed in and out as it rests, fills and leaves; an
+    // order with nothing remaining contributes zero, so a full fill simply removes its term
+    static uint64_t OrderHash(OrderId id, Price price, Side side, Quantity remaining) noexcept {
+        if(remaining==0) return 0;
+        uint64_t x=id*0x9E3779B97F4A7C15ull ^ (uint64_t(uint32_t(price))<<33 | uint64_t(side==Side::Sell)<<32 | remaining);
+        x=(x^(x>>30))*0xBF58476D1CE4E5B9ull; x=(x^(x>>27))*0x94D049BB133111EBull; // splitmix64 finaliser
+        return x^(x>>31);
+    }
+    static uint64_t OrderHash(const Order& o) noexcept { return OrderHash(o.GetOrderId(),o.GetPrice(),o.GetSide(),o.GetRemainingQuantity()); }
+
+    // restart slot numbering with the live orders, each marked with what is ahead of it right now
+    void CompactQueue(PriceLevel& lvl) noexcept {
+        lvl.queue=LevelQueue{};
+        uint64_t ahead=0;
+        for(const auto& o: lvl.orders){
+            orders_.find(o->GetOrderId())->second.mark=lvl.queue.Join(ahead);
+            ahead+=o->GetRemainingQuantity();
+        }
+    }
+
+    void AdjustBand(Side side, Price price, int64_t delta) noexcept {
+        DepthBand& band=side==Side::Buy ? bidBand_ : askBand_;
+        if(band.live && (side==Side::Buy ? price>=band.limit : price<=band.limit)) band.quantity+=delta;
+    }
+
+    template<Side S, class SideBook>
+    void RefreshBand(const SideBook& side, DepthBand& band) noexcept {
+        if(side.Empty()){ band.live=false; return; }
+        if(band.live && band.touch==side.BestPrice()) return;
+        band.live=true; band.touch=side.BestPrice(); band.quantity=0;
+        const int64_t width=int64_t(band.touch)*depthBps_/10000;
+        band.limit=Price(S==Side::Buy ? band.touch-width : band.touch+width);
+        side.ForEachTo(band.limit,[&](Price, const PriceLevel& lvl){ band.quantity+=lvl.data.quantity; return true; });
+    }
+
+    void PublishTop(std::span<const Trade> trades = {}) noexcept {
+        ++updateSeq_;
+        RefreshBand<Side::Buy>(bids_,bidBand_); RefreshBand<Side::Sell>(asks_,askBand_);
+        TopOfBook top; top.depthBps=depthBps_;
+        if(auto best=bids_.Best()){ top.bidPrice=best.price; top.bidQuantity=best.level->data.quantity; top.bidDepth=bidBand_.quantity; }
+        if(auto best=asks_.Best()){ top.askPrice=best.price; top.askQuantity=best.level->data.quantity; top.askDepth=askBand_.quantity; }
+        if(top.bidQuantity && top.askQuantity){
+            const double bq=double(top.bidQuantity), aq=double(top.askQuantity);
+            top.imbalance=(bq-aq)/(bq+aq);
+            top.microprice=(double(top.bidPrice)*aq+double(top.askPrice)*bq)/(bq+aq);
+        }
+        top_.Store(top);
+        if(publishDepth_.load(std::memory_order_relaxed)) depth_.Store(CaptureDepth());
+        for(auto& feed: feeds_) feed->Publish(changed_,top,updateSeq_);
+        for(auto& wire: wires_) PublishWire(*wire,trades);
+        changed_.Clear();
+    }
+
+    void PublishWire(WireRing& wire, std::span<const Trade> trades) noexcept {
+        if(wire.Free()<trades.size()+changed_.Size()+1) return; // dropped whole; receivers see the gap
+        for(const auto& t: trades) wire.TryPush(WireEvent{WireEvent::Kind::Trade,t.aggressor,t.bid.price,0,t.bid.quantity,t.sequence});
+        changed_.ForEach([&](const LevelUpdate& u){ wire.TryPush(WireEvent{WireEvent::Kind::Level,u.side,u.price,u.data.count,u.data.quantity,0}); });
+        wire.TryPush(WireEvent{WireEvent::Kind::Publication,Side::Buy,0,0,0,updateSeq_});
+    }
+
+    template<class SideBook>
+    static std::vector<std::pair<Price,uint64_t>> Snapshot(const SideBook& side, size_t depth) {
+        std::vector<std::pair<Price,uint64_t>> out; out.reserve(std::min(depth,side.LevelCount()));
+        side.ForEach([&](Price p, const PriceLevel& lvl){
+            if(out.size()>=depth) return false;
+            uint64_t qty=0; for(auto& o:lvl.orders) qty+=o->GetRemainingQuantity();
+            out.emplace_back(p,qty);
+            return true;
+        });
+        return out;
+    }
+
+    // matching helpers
+    bool CanMatch(Side side, Price price) const noexcept {
+        if(side==Side::Buy){ if(asks_.Empty()) return false; return price>=asks_.BestPrice(); }
+        else{ if(bids_.Empty()) return false; return price<=bids_.BestPrice(); }
+    }
+
+    bool CanFullyFill(Side side, Price price, Quantity qty) const noexcept {
+        if(!CanMatch(side,price)) return false;
+        return WalkLevels(side,price,qty).quantity==qty;
+    }
+
+    // what an aggressor of `side` limited to `limit` and `quantity` would take, from level aggregates only
+    SweepEstimate WalkLevels(Side side, Price limit, uint64_t quantity) const noexcept {
+        return Walk(quantity,[&](auto&& take){
+            auto visit=[&](Price p, const PriceLevel& lvl){ return take(p,lvl.data.quantity); };
+            if(side==Side::Buy) asks_.ForEachTo(limit,visit); else bids_.ForEachTo(limit,visit);
+        });
+    }
+
+    // forEach(take) feeds (price, quantity) levels best first until take returns false
+    template<class F>
+    static SweepEstimate Walk(uint64_t quantity, F&& forEach) noexcept {
+        SweepEstimate est; int64_t notional=0;
+        forEach([&](Price p, uint64_t available){
+            const uint64_t q=std::min<uint64_t>(available,quantity-est.quantity);
+            est.quantity+=q; notional+=int64_t(p)*int64_t(q); est.worstPrice=p; est.levels++;
+            return est.quantity<quantity;
+        });
+        if(est.quantity) est.averagePrice=double(notional)/double(est.quantity);
+        return est;
+    }
+
+    // from the published levels when they cover the walk, else under the lock
+    SweepEstimate Estimate(Side side, Price limit, uint64_t quantity) const noexcept {
+        if(publishDepth_.load(std::memory_order_acquire)){
+            const BookDepth depth=depth_.Load();
+            const auto& levels=side==Side::Buy ? depth.asks : depth.bids;
+            const size_t count=side==Side::Buy ? depth.askLevels : depth.bidLevels;
+            bool covered=!(side==Side::Buy ? depth.asksTruncated : depth.bidsTruncated);
+            auto est=Walk(quantity,[&](auto&& take){
+                for(size_t i=0; i<count; ++i){
+                    const Price p=levels[i].price;
+                    if((side==Side::Buy ? p>limit : p<limit) || !take(p,levels[i].quantity)){ covered=true; return; }
+                }
+            });
+            if(covered) return est;
+        }
+        std::scoped_lock lock(mutex_);
+        return WalkLevels(side,limit,quantity);
+    }
+
+    BookDepth CaptureDepth() const noexcept {
+        BookDepth depth;
+        auto capture=[](const auto& side, auto& levels, uint8_t& count, bool& truncated){
+            side.ForEach([&](Price p, const PriceLevel& lvl){
+                if(count==BookDepth::Levels){ truncated=true; return false; }
+                levels[count++]={p,lvl.data.quantity};
+                return true;
+            });
+        };
+        capture(bids_,depth.bids,depth.bidLevels,depth.bidsTruncated);
+        capture(asks_,depth.asks,depth.askLevels,depth.asksTruncated);
+        return depth;
+    }
+
+    // ids filled during a sweep, tagged with their orders_ bucket. Kept on the stack and erased
+    // from the index in bucket order once the walk is done (or the buffer fills), instead of
+    // interleaving hash-table writes with the matching loop. Erase never rehashes, so bucket
+    // indices taken during the sweep stay valid until the flush.
+    struct FilledBatch {
+        static constexpr size_t Capacity = 64;
+        std::array<std::pair<size_t,OrderId>,Capacity> slots;
+        size_t size = 0;
+    };
+
+    void DeferErase(FilledBatch& batch, OrderId id) noexcept {
+        if(batch.size==FilledBatch::Capacity) [[unlikely]] FlushFilled(batch);
+        batch.slots[batch.size++]={orders_.bucket(id),id};
+    }
+
+    void FlushFilled(FilledBatch& batch) noexcept {
+        const auto first=batch.slots.begin(), last=first+batch.size;
+        std::sort(first,last,[](const auto& a, const auto& b){ return a.first<b.first; });
+        for(auto it=first; it!=last; ++it){ auto found=orders_.find(it->second); EraseEntry(found,found->second.order->GetOwner()); }
+        batch.size=0;
+    }
+
+    // A is the side of the order just added. The book was uncrossed before it arrived, so the
+    // aggressor sits alone at the front of its level while the resting queue cycles through
+    // (typically many small) orders: resting fills are the likely branch, the aggressor filling
+    // ends the sweep. Every fill executes at the resting level's price; reaching a level beyond
+    // the halt bounds halts the book and leaves the rest of the aggressor resting, crossed.
+    template<Side A>
+    std::vector<Trade> MatchOrders() noexcept {
+        std::vector<Trade> trades;
+        FilledBatch filled;
+        while(!bids_.Empty() && !asks_.Empty()){
+            auto [bidPrice,bidLevel]=bids_.Best(); auto [askPrice,askLevel]=asks_.Best();
+            if(bidPrice<askPrice) break;
+            PriceLevel& inLevel=A==Side::Buy ? *bidLevel : *askLevel;
+            PriceLevel& restLevel=A==Side::Buy ? *askLevel : *bidLevel;
+            const Price execPrice=A==Side::Buy ? askPrice : bidPrice, inPrice=A==Side::Buy ? bidPrice : askPrice;
+            if(execPrice<haltLo_ || execPrice>haltHi_) [[unlikely]] { state_=SessionState::Halted; break; }
+            auto &incoming=inLevel.orders, &resting=restLevel.orders;
+            while(!incoming.empty() && !resting.empty()){
+                Order& in=*incoming.front(); Order& rest=*resting.front();
+                // the next resting order is filled on the following iteration
+                if(auto next=std::next(resting.begin()); next!=resting.end()) ORDERBOOK_PREFETCH(next->get());
+                const Quantity qty=std::min(in.GetRemainingQuantity(),rest.GetRemainingQuantity());
+                in.Fill(qty); rest.Fill(qty);
+                const Order& bid=A==Side::Buy ? in : rest; const Order& ask=A==Side::Buy ? rest : in;
+                trades.emplace_back(TradeInfo{bid.GetOrderId(),execPrice,qty},TradeInfo{ask.GetOrderId(),execPrice,qty},A,++executionSeq_);
+                OnOrderMatched(A,inPrice,inLevel,in,qty); OnOrderMatched(Opposite(A),execPrice,restLevel,rest,qty);
+                if(rest.IsFilled()) [[likely]] { DeferErase(filled,rest.GetOrderId()); resting.pop_front(); }
+                if(in.IsFilled()) [[unlikely]] { DeferErase(filled,in.GetOrderId()); incoming.pop_front(); }
+            }
+            if(bidLevel->orders.empty()) bids_.Erase(bidPrice);
+            if(askLevel->orders.empty()) asks_.Erase(askPrice);
+        }
+        FlushFilled(filled);
+        if(auto best=bids_.Best(); best && best.level->orders.front()->GetOrderType()==OrderType::FillAndKill)
+            CancelOrderInternal(best.level->orders.front()->GetOrderId());
+        if(auto best=asks_.Best(); best && best.level->orders.front()->GetOrderType()==OrderType::FillAndKill)
+            CancelOrderInternal(best.level->orders.front()->GetOrderId());
+        return trades;
+    }
+
+    // single-price auction over a crossed book: the price executing the most quantity, then leaving
+    // the least surplus, then nearest the last trade (the crossed range's midpoint before any
+    // trade). Everything executable there trades at that price in price-time priority; the side
+    // with the surplus is reported as aggressor (buy on a tie). Afterwards the book is uncrossed
+    std::vector<Trade> UncrossInternal(TimePoint at) noexcept {
+        if(bids_.Empty() || asks_.Empty() || bids_.BestPrice()<asks_.BestPrice()) return {};
+        const Price lo=asks_.BestPrice(), hi=bids_.BestPrice();
+        const int64_t reference=lastTradePrice_ ? lastTradePrice_ : (int64_t(lo)+hi)/2;
+        std::vector<std::pair<Price,uint64_t>> crossedBids, crossedAsks, candidates; // levels best first
+        bids_.ForEachTo(lo,[&](Price p, const PriceLevel& lvl){ crossedBids.emplace_back(p,lvl.data.quantity); return true; });
+        asks_.ForEachTo(hi,[&](Price p, const PriceLevel& lvl){ crossedAsks.emplace_back(p,lvl.data.quantity); return true; });
+        candidates=crossedAsks; candidates.insert(candidates.end(),crossedBids.rbegin(),crossedBids.rend());
+        std::sort(candidates.begin(),candidates.end());
+        uint64_t buyAll=0; for(const auto& b: crossedBids) buyAll+=b.second;
+        // sweep candidates upward: asks at or below p join, bids below p drop out
+        struct { Price price=0; uint64_t volume=0, surplus=0; int64_t distance=0; Side aggressor=Side::Buy; } best;
+        size_t a=0, b=crossedBids.size(); uint64_t sell=0, buyBelow=0;
+        for(const auto& [p,unused]: candidates){
+            while(a<crossedAsks.size() && crossedAsks[a].first<=p) sell+=crossedAsks[a++].second;
+            while(b>0 && crossedBids[b-1].first<p) buyBelow+=crossedBids[--b].second;
+            const uint64_t buy=buyAll-buyBelow, volume=std::min(buy,sell), surplus=std::max(buy,sell)-volume;
+            const int64_t distance=std::abs(int64_t(p)-reference);
+            if(volume>best.volume || (volume==best.volume && (surplus<best.surplus || (surplus==best.surplus && distance<best.distance))))
+                best={p,volume,surplus,distance,sell>buy ? Side::Sell : Side::Buy};
+        }
+        std::vector<Trade> trades;
+        FilledBatch filled;
+        for(uint64_t left=best.volume; left>0;){
+            auto [bidPrice,bidLevel]=bids_.Best(); auto [askPrice,askLevel]=asks_.Best();
+            Order& bid=*bidLevel->orders.front(); Order& ask=*askLevel->orders.front();
+            const Quantity qty=Quantity(std::min<uint64_t>({bid.GetRemainingQuantity(),ask.GetRemainingQuantity(),left}));
+            bid.Fill(qty); ask.Fill(qty); left-=qty;
+            trades.emplace_back(TradeInfo{bid.GetOrderId(),best.price,qty},TradeInfo{ask.GetOrderId(),best.price,qty},best.aggressor,++executionSeq_);
+            OnOrderMatched(Side::Buy,bidPrice,*bidLevel,bid,qty); OnOrderMatched(Side::Sell,askPrice,*askLevel,ask,qty);
+            if(bid.IsFilled()){ DeferErase(filled,bid.GetOrderId()); bidLevel->orders.pop_front(); if(bidLevel->orders.empty()) bids_.Erase(bidPrice); }
+            if(ask.IsFilled()){ DeferErase(filled,ask.GetOrderId()); askLevel->orders.pop_front(); if(askLevel->orders.empty()) asks_.Erase(askPrice); }
+        }
+        FlushFilled(filled);
+        haltAnchorTime_={}; // the circuit breaker window restarts at the uncross price
+        if(!trades.empty()) RecordTrades(trades,at);
+        return trades;
+    }
+
+    // owner 0 is the operator and may touch any order
+    bool OwnedByOther(OrderId id, OwnerId owner) const noexcept {
+        if(!owner) return false;
+        auto found=orders_.find(id);
+        return found!=orders_.end() && found->second.order->GetOwner()!=owner;
+    }
+
+    bool CancelOrderInternal(OrderId id) noexcept {
+        auto found=orders_.find(id);
+        if(found==orders_.end()) return false;
+        auto order=std::move(found->second.order); auto it=found->second.it; auto mark=found->second.mark;
+        EraseEntry(found,order->GetOwner());
+        if(order->GetSide()==Side::Sell) RemoveFromLevel(asks_,order,it,mark);
+        else RemoveFromLevel(bids_,order,it,mark);
+        return true;
+    }
+
+    template<class SideBook>
+    void RemoveFromLevel(SideBook& side, const OrderPtr& order, OrderPointers::iterator it, const QueueMark& mark) noexcept {
+        PriceLevel& lvl=*side.Find(order->GetPrice());
+        lvl.orders.erase(it);
+        lvl.queue.Leave(mark,order->GetRemainingQuantity());
+        OnOrderCancelled(order->GetSide(),order->GetPrice(),lvl,order);
+        if(lvl.orders.empty()) side.Erase(order->GetPrice());
+    }
+
+    void ExpireGoodForDayInternal() noexcept {
+        std::vector<OrderId> toCancel; for(auto &[id,entry]: orders_) if(entry.order->GetOrderType()==OrderType::GoodForDay) toCancel.push_back(id);
+        for(auto id:toCancel) CancelOrderInternal(id);
+    }
+};
+
+// compile-time backend choice per instrument class
+using OrderBook = BasicOrderBook<MapSide>;          // reference
+using LadderOrderBook = BasicOrderBook<LadderSide>; // dense tick ladder, bounded price range
+using FlatOrderBook = BasicOrderBook<FlatSide>;     // sorted contiguous levels
+using SkipListOrderBook = BasicOrderBook<SkipListSide>;
+using HybridOrderBook = BasicOrderBook<HybridSide>; // array near the touch, tree for depth
+
+// ----- recovery -----
+// full depth of a book as of one publication, best first on each side
+struct BookImage {
+    uint64_t sequence = 0;
+    std::vector<std::pair<Price, LevelData>> bids, asks;
+    TopOfBook top;
+};
+
+// read-only copy of a book's levels kept up to date from published updates
+class BookReplica {
+public:
+    void Reset(const BookImage& image) {
+        bids_.clear(); asks_.clear();
+        for (const auto& [p, d] : image.bids) bids_.emplace(p, d);
+        for (const auto& [p, d] : image.asks) asks_.emplace(p, d);
+        top_ = image.top; sequence_ = image.sequence;
+    }
+
+    // splice an update onto the replica; false, and nothing applied, if the replica is already past it
+    bool Apply(const ConflatedUpdate& update) {
+        if (update.sequence <= sequence_) return false;
+        for (const auto& u : update.levels) Apply(u);
+        if (update.top) top_ = *update.top;
+        sequence_ = update.sequence;
+        return true;
+    }
+
+    void Apply(const LevelUpdate& u) {
+        if (u.side == Side::Buy) { if (u.data.count) bids_[u.price] = u.data; else bids_.erase(u.price); }
+        else { if (u.data.count) asks_[u.price] = u.data; else asks_.erase(u.price); }
+    }
+
+    uint64_t Sequence() const noexcept { return sequence_; }
+    const TopOfBook& Top() const noexcept { return top_; }
+    BookImage Image() const { return BookImage{sequence_, {bids_.begin(), bids_.end()}, {asks_.begin(), asks_.end()}, top_}; }
+
+private:
+    uint64_t sequence_ = 0;
+    std::map<Price, LevelData, std::greater<Price>> bids_;
+    std::map<Price, LevelData> asks_;
+    TopOfBook top_;
+};
+
+// serves late joiners and consumers that lost their place. A service thread keeps its own replica
+// from one conflating feed and republishes it as an immutable image at most once per interval;
+// Snapshot hands out that image, so recoveries never touch the live book or its lock. To join:
+//   auto feed = book.Subscribe(false);
+//   replica.Reset(*recovery.SnapshotAfter(feed->JoinedAt()));
+//   then poll the feed and Apply; updates the image already covers are skipped.
+// The service must not outlive the book it was built on.
+class RecoveryService {
+public:
+    template<class Book>
+    explicit RecoveryService(Book& book, std::chrono::microseconds interval = std::chrono::milliseconds(1))
+        : feed_(book.Subscribe()), detach_([&book, feed = feed_] { book.Unsubscribe(feed); }), interval_(interval),
+          image_(std::make_shared<const BookImage>()), thread_([this] { Run(); }) {}
+
+    ~RecoveryService() {
+        { std::scoped_lock lock(mutex_); stop_ = true; }
+        cv_.notify_all();
+        thread_.join();
+        detach_();
+    }
+
+    RecoveryService(const RecoveryService&) = delete;
+    RecoveryService& operator=(const RecoveryService&) = delete;
+
+    // the latest published image; never blocks on the book
+    std::shared_ptr<const BookImage> Snapshot() const { std::scoped_lock lock(mutex_); return image_; }
+
+    // the first image at or past sequence; null if none is published within the timeout
+    std::shared_ptr<const BookImage> SnapshotAfter(uint64_t sequence, std::chrono::milliseconds timeout = std::chrono::seconds(1)) const {
+        std::unique_lock lock(mutex_);
+        if (!cv_.wait_for(lock, timeout, [&] { return image_->sequence >= sequence || stop_; }) || image_->sequence < sequence) return nullptr;
+        return image_;
+    }
+
+private:
+    std::shared_ptr<ConflatingFeed> feed_;
+    std::function<void()> detach_;
+    std::chrono::microseconds interval_;
+    mutable std::mutex mutex_;
+    mutable std::condition_variable cv_;
+    bool stop_ = false;
+    std::shared_ptr<const BookImage> image_;
+    std::thread thread_;
+
+    void Run() {
+        BookReplica replica;
+        ConflatedUpdate update;
+        std::unique_lock lock(mutex_);
+        while (!stop_) {
+            lock.unlock();
+            feed_->Poll(update); // may only advance the sequence, which late joiners still wait on
+            replica.Apply(update);
+            auto image = replica.Sequence() != image_->sequence ? std::make_shared<const BookImage>(replica.Image()) : nullptr;
+            lock.lock();
+            if (image) { image_ = std::move(image); cv_.notify_all(); }
+            cv_.wait_for(lock, interval_, [this] { return stop_; });
+        }
+    }
+};
+
+// ----- UDP market data -----
+// packet: packet sequence (u64), message count (u16), then messages, host byte order
+//   level:       'L' side(u8) price(i32) count(u32) quantity(u64)     18 bytes
+//   trade:       'T' aggressor(u8) price(i32) quantity(u64) seq(u64)  22 bytes
+//   publication: 'P' sequence(u64)                                    9 bytes
+class WireEncoder {
+public:
+    static constexpr size_t MaxPacket = 1400; // stays inside one Ethernet frame
+    static constexpr size_t HeaderSize = 10;
+
+    WireEncoder() { Start(0); }
+
+    // false if the message does not fit; send and Start a new packet, then append again
+    bool Append(const WireEvent& e) noexcept {
+        const size_t need = e.kind == WireEvent::Kind::Level ? 18 : e.kind == WireEvent::Kind::Trade ? 22 : 9;
+        if (size_ + need > MaxPacket) return false;
+        switch (e.kind) {
+            case WireEvent::Kind::Level: Put('L'); Put(uint8_t(e.side)); Put(e.price); Put(e.count); Put(e.quantity); break;
+            case WireEvent::Kind::Trade: Put('T'); Put(uint8_t(e.side)); Put(e.price); Put(e.quantity); Put(e.sequence); break;
+            case WireEvent::Kind::Publication: Put('P'); Put(e.sequence); break;
+        }
+        ++messages_;
+        std::memcpy(buf_.data() + 8, &messages_, sizeof(messages_));
+        return true;
+    }
+
+    void Start(uint64_t packetSequence) noexcept {
+        size_ = 0; messages_ = 0;
+        Put(packetSequence); Put(messages_);
+    }
+    bool Empty() const noexcept { return messages_ == 0; }
+    std::span<const uint8_t> Bytes() const noexcept { return {buf_.data(), size_}; }
+
+private:
+    std::array<uint8_t, MaxPacket> buf_;
+    size_t size_ = 0;
+    uint16_t messages_ = 0;
+
+    template<class T> void Put(T v) noexcept { std::memcpy(buf_.data() + size_, &v, sizeof(T)); size_ += sizeof(T); }
+};
+
+// rebuilds a BookReplica from packets. Levels are held back until their publication closes, so a
+// publication is applied whole or not at all. After a lost packet or a publication the book could
+// not fit into its ring, NeedsImage() holds until Reset is given an image at or past ResyncPoint()
+// (see RecoveryService). Publications that arrive meanwhile are kept and replayed over the image,
+// less those it already covers.
+class WireDecoder {
+public:
+    std::function<void(const WireEvent&)> onTrade;
+
+    // false if the packet is malformed
+    bool OnPacket(std::span<const uint8_t> packet) {
+        size_t at = 0;
+        uint64_t sequence; uint16_t messages;
+        if (!Get(packet, at, sequence) || !Get(packet, at, messages)) return false;
+        if (!started_ || sequence != nextPacket_) Desync();
+        started_ = true; nextPacket_ = sequence + 1;
+        for (uint16_t m = 0; m < messages; ++m) {
+            uint8_t type, side;
+            if (!Get(packet, at, type)) return false;
+            WireEvent e;
+            if (type == 'L') {
+                e.kind = WireEvent::Kind::Level;
+                if (!Get(packet, at, side) || !Get(packet, at, e.price) || !Get(packet, at, e.count) || !Get(packet, at, e.quantity)) return false;
+                e.side = Side(side);
+                if (inPublication_) pending_.levels.push_back(LevelUpdate{e.side, e.price, LevelData{e.count, e.quantity}});
+            } else if (type == 'T') {
+                e.kind = WireEvent::Kind::Trade;
+                if (!Get(packet, at, side) || !Get(packet, at, e.price) || !Get(packet, at, e.quantity) || !Get(packet, at, e.sequence)) return false;
+                e.side = Side(side);
+                if (onTrade) onTrade(e);
+            } else if (type == 'P') {
+                if (!Get(packet, at, e.sequence)) return false;
+                ClosePublication(e.sequence);
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void Reset(const BookImage& image) {
+        replica_.Reset(image);
+        if (image.sequence < resyncPoint_) return;
+        for (const auto& update : held_) replica_.Apply(update);
+        held_.clear(); stale_ = false;
+    }
+
+    bool NeedsImage() const noexcept { return !inPublication_ || stale_; }
+    uint64_t ResyncPoint() const noexcept { return resyncPoint_; }
+    const BookReplica& Replica() const noexcept { return replica_; }
+
+private:
+    BookReplica replica_;
+    ConflatedUpdate pending_;
+    bool started_ = false, inPublication_ = false; // inPublication_: the next message starts or continues a whole publication
+    bool stale_ = true;                   // the replica missed something since its last good image
+    std::vector<ConflatedUpdate> held_;   // whole publications since resyncPoint_, while stale
+    uint64_t nextPacket_ = 0, lastPublication_ = 0, resyncPoint_ = 0;
+
+    void Desync() noexcept { inPublication_ = false; pending_.levels.clear(); }
+
+    void ClosePublication(uint64_t sequence) {
+        pending_.sequence = sequence;
+        if (!inPublication_ || sequence != lastPublication_ + 1) { resyncPoint_ = sequence; stale_ = true; held_.clear(); }
+        else if (stale_) held_.push_back(pending_);
+        else replica_.Apply(pending_);
+        pending_.levels.clear();
+        inPublication_ = true; lastPublication_ = sequence;
+    }
+
+    template<class T> static bool Get(std::span<const uint8_t> in, size_t& at, T& v) noexcept {
+        if (at + sizeof(T) > in.size()) return false;
+        std::memcpy(&v, in.data() + at, sizeof(T)); at += sizeof(T);
+        return true;
+    }
+};
+
+namespace detail {
+// IPv4 address plus port; multicast groups are looped back to local receivers
+inline sockaddr_in UdpEndpoint(const std::string& address, uint16_t port) {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) throw std::invalid_argument(std::format("bad IPv4 address: {}", address));
+    return addr;
+}
+
+inline bool IsMulticast(const sockaddr_in& addr) { return (ntohl(addr.sin_addr.s_addr) >> 28) == 14; }
+
+inline int UdpSocket() {
+    const int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) throw std::system_error(errno, std::generic_category(), "socket");
+    return fd;
+}
+} // namespace detail
+
+// drains a book's wire ring on its own thread, packs the events and sends them with sendto, so the
+// matching thread never makes a syscall. A packet goes out when full, or as soon as the ring runs
+// dry after a publication. The publisher must not outlive the book it was built on.
+class UdpPublisher {
+public:
+    template<class Book>
+    UdpPublisher(Book& book, const std::string& address, uint16_t port)
+        : dest_(detail::UdpEndpoint(address, port)), fd_(detail::UdpSocket()), wire_(book.OpenWire()),
+          detach_([&book, wire = wire_] { book.CloseWire(wire); }) {
+        if (detail::IsMulticast(dest_)) {
+            const unsigned char loop = 1, ttl = 1;
+            setsockopt(fd_, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+            setsockopt(fd_, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+        }
+        thread_ = std::thread([this] { Run(); });
+    }
+
+    ~UdpPublisher() {
+        detach_();
+        stop_.store(true);
+        thread_.join();
+        ::close(fd_);
+    }
+
+    UdpPublisher(const UdpPublisher&) = delete;
+    UdpPublisher& operator=(const UdpPublisher&) = delete;
+
+    uint64_t PacketsSent() const noexcept { return packets_.load(std::memory_order_relaxed); }
+
+private:
+    sockaddr_in dest_;
+    int fd_;
+    std::shared_ptr<WireRing> wire_;
+    std::function<void()> detach_;
+    std::atomic<bool> stop_{false};
+    std::atomic<uint64_t> packets_{0};
+    std::thread thread_;
+
+    void Run() {
+        WireEncoder packet;
+        WireEvent e;
+        uint64_t sequence = 0;
+        auto send = [&] {
+            ::sendto(fd_, packet.Bytes().data(), packet.Bytes().size(), 0, reinterpret_cast<const sockaddr*>(&dest_), sizeof(dest_));
+            packets_.store(++sequence, std::memory_order_relaxed);
+            packet.Start(sequence);
+        };
+        for (;;) {
+            if (wire_->TryPop(e)) {
+                if (!packet.Append(e)) { send(); packet.Append(e); }
+                continue;
+            }
+            if (!packet.Empty()) { send(); continue; }
+            if (stop_.load()) return; // detached first, so nothing more can arrive
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+};
+
+// a bound UDP socket feeding a WireDecoder; joins the group when the address is multicast
+class UdpReceiver {
+public:
+    UdpReceiver(const std::string& address, uint16_t port) : fd_(detail::UdpSocket()) {
+        const sockaddr_in group = detail::UdpEndpoint(address, port);
+        const int on = 1;
+        setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        sockaddr_in local = group;
+        if (detail::IsMulticast(group)) local.sin_addr.s_addr = htonl(INADDR_ANY);
+        if (::bind(fd_, reinterpret_cast<const sockaddr*>(&local), sizeof(local)) < 0) {
+            const int err = errno; ::close(fd_);
+            throw std::system_error(err, std::generic_category(), "bind");
+        }
+        if (detail::IsMulticast(group)) {
+            ip_mreq req{};
+            req.imr_multiaddr = group.sin_addr;
+            req.imr_interface.s_addr = htonl(INADDR_ANY);
+            if (setsockopt(fd_, IPPROTO_IP, IP_ADD_MEMBERSHIP, &req, sizeof(req)) < 0) {
+                const int err = errno; ::close(fd_);
+                throw std::system_error(err, std::generic_category(), "IP_ADD_MEMBERSHIP");
+            }
+        }
+    }
+    ~UdpReceiver() { ::close(fd_); }
+
+    UdpReceiver(const UdpReceiver&) = delete;
+    UdpReceiver& operator=(const UdpReceiver&) = delete;
+
+    // wait up to timeout for one packet and decode it; false on timeout or a malformed packet
+    bool Receive(std::chrono::milliseconds timeout) {
+        pollfd p{fd_, POLLIN, 0};
+        if (::poll(&p, 1, int(timeout.count())) <= 0) return false;
+        const ssize_t n = ::recv(fd_, buf_.data(), buf_.size(), 0);
+        return n > 0 && decoder_.OnPacket({buf_.data(), size_t(n)});
+    }
+
+    WireDecoder& Decoder() noexcept { return decoder_; }
+
+private:
+    int fd_;
+    WireDecoder decoder_;
+    std::array<uint8_t, 2048> buf_;
+};
+
+// ----- hibernation -----
+// owns many books by id and keeps the idle ones hibernated, each as one dense byte vector, so an
+// options chain of mostly quiet instruments costs little more than its resting orders. A book is
+// revived on its first Acquire after hibernating; ids never acquired cost nothing. ApplySessionEvent
+// covers live and dormant books alike.
+template<class Book = OrderBook>
+class BookRegistry {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // the book for id, created empty or revived as needed; it stays live while any caller holds it
+    std::shared_ptr<Book> Acquire(uint32_t id) {
+        std::scoped_lock lock(mutex_);
+        Entry& e = books_[id];
+        e.lastUsed = Clock::now();
+        if (!e.live) {
+            e.live = std::make_shared<Book>();
+            e.live->SetInstrument(e.instrument);
+            if (!e.dormant.empty()) { e.live->Restore(e.dormant); std::vector<uint8_t>().swap(e.dormant); }
+        }
+        return e.live;
+    }
+
+    // reference data for id's book, kept here so a revived book validates like the one hibernated
+    void SetInstrument(uint32_t id, const InstrumentSpec* spec) {
+        std::scoped_lock lock(mutex_);
+        Entry& e = books_[id];
+        e.instrument = spec;
+        if (e.live) e.live->SetInstrument(spec);
+    }
+
+    // hibernate every live book unused for at least idle and not held by anyone; returns how many
+    size_t HibernateIdle(Clock::duration idle) {
+        std::scoped_lock lock(mutex_);
+        const auto cutoff = Clock::now() - idle;
+        size_t count = 0;
+        for (auto& [id, e] : books_) {
+            if (!e.live || e.live.use_count() > 1 || e.lastUsed > cutoff) continue;
+            if (auto bytes = e.live->Hibernate()) { e.dormant = std::move(*bytes); e.live.reset(); ++count; }
+        }
+        return count;
+    }
+
+    // a session transition for every book; dormant books are revived only if the event has orders
+    // of theirs to act on
+    void ApplySessionEvent(SessionEvent event) {
+        std::scoped_lock lock(mutex_);
+        for (auto& [id, e] : books_) {
+            if (e.live) { e.live->ApplySessionEvent(event); continue; }
+            if (e.dormant.empty() || Book::DormantApplySessionEvent(e.dormant, event)) continue;
+            Book book;
+            book.Restore(e.dormant);
+            book.ApplySessionEvent(event);
+            e.dormant = std::move(*book.Hibernate());
+        }
+    }
+
+    size_t LiveCount() const { std::scoped_lock lock(mutex_); return size_t(std::count_if(books_.begin(), books_.end(), [](const auto& kv) { return kv.second.live != nullptr; })); }
+    size_t DormantBytes() const {
+        std::scoped_lock lock(mutex_);
+        size_t bytes = 0;
+        for (const auto& [id, e] : books_) bytes += e.dormant.size();
+        return bytes;
+    }
+
+private:
+    struct Entry {
+        std::shared_ptr<Book> live;
+        std::vector<uint8_t> dormant; // set exactly when live is null and the book has been used (not just SetInstrument)
+        Clock::time_point lastUsed;
+        const InstrumentSpec* instrument = nullptr;
+    };
+    mutable std::mutex mutex_;
+    std::unordered_map<uint32_t, Entry> books_;
+};
+
+// ----- session scheduler -----
+// when session events fire for one group of books: times of day in the group's local time, given as
+// a fixed offset from UTC. Named zones with daylight-saving rules would need the tz database, which
+// not every standard library ships yet; move the offset when the clocks change.
+struct SessionSchedule {
+    // the machine's current offset, which is what the per-book pruning threads used to follow
+    static std::chrono::minutes MachineUtcOffset() {
+        const std::time_t now = std::time(nullptr);
+        std::tm local{};
+        localtime_r(&now, &local);
+        return std::chrono::minutes(local.tm_gmtoff / 60);
+    }
+
+    std::chrono::minutes utcOffset = MachineUtcOffset();
+    std::vector<std::pair<std::chrono::minutes, SessionEvent>> events{{std::chrono::hours(16), SessionEvent::ExpireGoodForDay}};
+    uint8_t weekdays = 0x7f; // bit n: fire on weekday n, 0 = Sunday
+};
+
+// one thread for the whole process: it sleeps until the next event of any schedule and hands it to
+// that schedule's sink, which forwards it to the books (Sequencer::SessionSink routes it through
+// each book's shard, BookRegistry::ApplySessionEvent covers dormant books). Replaces a sleeping
+// thread per book. Sinks run on the scheduler thread without its lock held.
+class SessionScheduler {
+public:
+    using Clock = std::chrono::system_clock;
+    using Sink = std::function<void(SessionEvent)>;
+
+    // run = false: no thread; the owner drives RunDue itself (simulations, tests)
+    explicit SessionScheduler(bool run = true) { if (run) thread_ = std::thread([this] { Run(); }); }
+
+    ~SessionScheduler() {
+        { std::scoped_lock lock(mutex_); stop_ = true; }
+        cv_.notify_all();
+        if (thread_.joinable()) thread_.join();
+    }
+
+    SessionScheduler(const SessionScheduler&) = delete;
+    SessionScheduler& operator=(const SessionScheduler&) = delete;
+
+    // events fire from the first occurrence after now; returns a handle for Remove
+    size_t Add(SessionSchedule schedule, Sink sink) {
+        std::scoped_lock lock(mutex_);
+        Entry e{std::move(schedule), std::move(sink), {}};
+        for (const auto& [at, event] : e.schedule.events) e.next.push_back(NextAfter(e.schedule, at, Clock::now()));
+        entries_.emplace(++lastHandle_, std::move(e));
+        cv_.notify_all();
+        return lastHandle_;
+    }
+
+    void Remove(size_t handle) { std::scoped_lock lock(mutex_); entries_.erase(handle); }
+
+    // fire everything due at or before now, in time order; an event missed several times fires once
+    size_t RunDue(Clock::time_point now) {
+        struct Due { Clock::time_point at; Sink sink; SessionEvent event; };
+        std::vector<Due> due;
+        {
+            std::scoped_lock lock(mutex_);
+            for (auto& [handle, e] : entries_)
+                for (size_t i = 0; i < e.next.size(); ++i) {
+                    if (e.next[i] > now) continue;
+                    due.push_back({e.next[i], e.sink, e.schedule.events[i].second});
+                    e.next[i] = NextAfter(e.schedule, e.schedule.events[i].first, now);
+                }
+        }
+        std::stable_sort(due.begin(), due.end(), [](const Due& a, const Due& b) { return a.at < b.at; });
+        for (const auto& d : due) d.sink(d.event);
+        return due.size();
+    }
+
+    // first time after `after` that a schedule's event at local time of day `at` fires
+    static Clock::time_point NextAfter(const SessionSchedule& schedule, std::chrono::minutes at, Clock::time_point after) {
+        using namespace std::chrono;
+        const auto local = after + schedule.utcOffset;
+        const auto day = floor<days>(local);
+        for (int k = 0; k <= 7; ++k) {
+            const sys_days d = day + days(k);
+            const auto t = d + at;
+            if (t > local && (schedule.weekdays >> weekday(d).c_encoding() & 1)) return Clock::time_point(t - schedule.utcOffset);
+        }
+        return Clock::time_point::max(); // empty weekday mask: never
+    }
+
+private:
+    struct Entry {
+        SessionSchedule schedule;
+        Sink sink;
+        std::vector<Clock::time_point> next; // per schedule event
+    };
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    size_t lastHandle_ = 0;
+    std::map<size_t, Entry> entries_;
+    std::thread thread_;
+
+    void Run() {
+        std::unique_lock lock(mutex_);
+        while (!stop_) {
+            auto wake = Clock::time_point::max();
+            for (const auto& [handle, e] : entries_) for (auto t : e.next) wake = std::min(wake, t);
+            if (wake == Clock::time_point::max()) cv_.wait(lock);
+            else cv_.wait_until(lock, wake);
+            if (stop_) return;
+            lock.unlock();
+            RunDue(Clock::now());
+            lock.lock();
+        }
+    }
+};
+
+// ----- commands -----
+// one inbound instruction against a book; the unit of replay for the differential harness
+enum class CommandType { Add, Cancel, Modify, Session, CancelOwned };
+
+struct Command {
+    CommandType type;
+    OrderType orderType;
+    OrderId id;
+    Side side;
+    Price price;
+    Quantity quantity;
+    SessionEvent session = SessionEvent::PreOpen; // Session commands only
+    OwnerId owner = 0;                            // Add: the order's owner; Cancel/Modify: who must own it; CancelOwned: whose orders
+};
+using CommandStream = std::vector<Command>;
+
+// text form, one command per line: "A <type> <id> <B|S> <price> <qty> [@<owner>]", "C <id> [@<owner>]",
+// "M <id> <B|S> <price> <qty> [@<owner>]", "S <event>", "X <owner>"
+inline const char* OrderTypeCode(OrderType t) {
+    switch (t) {
+        case OrderType::GoodTillCancel: return "GTC";
+        case OrderType::FillAndKill: return "FAK";
+        case OrderType::FillOrKill: return "FOK";
+        case OrderType::GoodForDay: return "GFD";
+        case OrderType::Market: return "MKT";
+    }
+    return "?";
+}
+
+inline std::ostream& operator<<(std::ostream& os, const Command& c) {
+    const char side = c.side == Side::Buy ? 'B' : 'S';
+    switch (c.type) {
+        case CommandType::Add:
+            os << "A " << OrderTypeCode(c.orderType) << ' ' << c.id << ' ' << side << ' ' << c.price << ' ' << c.quantity;
+            break;
+        case CommandType::Cancel: os << "C " << c.id; break;
+        case CommandType::Modify: os << "M " << c.id << ' ' << side << ' ' << c.price << ' ' << c.quantity; break;
+        case CommandType::Session: return os << "S " << SessionEventName(c.session);
+        case CommandType::CancelOwned: return os << "X " << c.owner;
+    }
+    return c.owner ? os << " @" << c.owner : os;
+}
+
+inline void SaveCommands(std::ostream& os, const CommandStream& stream) {
+    for (const auto& c : stream) os << c << '\n';
+}
+
+// one command from the rest of a line; empty for blank lines, comments and unknown kinds
+inline std::optional<Command> ParseCommand(std::istream& in, const std::string& line) {
+    std::string kind, type;
+    char side = 'B';
+    Command c{CommandType::Add, OrderType::GoodTillCancel, 0, Side::Buy, 0, 0};
+    auto owner = [&] { if (in && !in.eof() && !(in >> std::ws).eof() && in.peek() == '@') { in.get(); in >> c.owner; } };
+    if (!(in >> kind) || kind.starts_with('#')) return std::nullopt;
+    if (kind == "A") {
+        in >> type >> c.id >> side >> c.price >> c.quantity;
+        bool known = false;
+        for (auto t : {OrderType::GoodTillCancel, OrderType::FillAndKill, OrderType::FillOrKill, OrderType::GoodForDay, OrderType::Market})
+            if (type == OrderTypeCode(t)) { c.orderType = t; known = true; }
+        if (!known) in.setstate(std::ios::failbit);
+        owner();
+    } else if (kind == "C") {
+        c.type = CommandType::Cancel; in >> c.id; owner();
+    } else if (kind == "M") {
+        c.type = CommandType::Modify; in >> c.id >> side >> c.price >> c.quantity; owner();
+    } else if (kind == "S") {
+        c.type = CommandType::Session; in >> type;
+        bool known = false;
+        for (uint8_t e = 0; e < SessionEventCount; ++e)
+            if (type == SessionEventName(SessionEvent(e))) { c.session = SessionEvent(e); known = true; }
+        if (!known) in.setstate(std::ios::failbit);
+    } else if (kind == "X") {
+        c.type = CommandType::CancelOwned; in >> c.owner;
+    } else {
+        return std::nullopt;
+    }
+    if (!in) throw std::runtime_error(std::format("malformed command line: {}", line));
+    c.side = side == 'S' ? Side::Sell : Side::Buy;
+    return c;
+}
+
+inline CommandStream LoadCommands(std::istream& is) {
+    CommandStream stream;
+    std::string line;
+    while (std::getline(is, line)) {
+        std::istringstream in(line);
+        if (auto c = ParseCommand(in, line)) stream.push_back(*c);
+    }
+    return stream;
+}
+
+// random but reproducible flow concentrated around a mid price, with enough crossing
+// to exercise sweeps, partial fills and every order type
+struct GeneratorConfig {
+    Price midPrice = 1000;
+    Price priceSpread = 20;     // limit prices drawn from mid +/- spread
+    Quantity maxQuantity = 50;
+    int cancelPercent = 20;
+    int modifyPercent = 10;
+    int sessionPercent = 0;     // random session events, auctions and halts among them
+    OwnerId owners = 0;         // adds tagged with owners 1..owners, and as many CancelOwned as session events
+};
+
+inline CommandStream GenerateCommands(uint64_t seed, size_t count, const GeneratorConfig& cfg = {}) {
+    std::mt19937_64 rng(seed);
+    auto uniform = [&](int64_t lo, int64_t hi) { return std::uniform_int_distribution<int64_t>(lo, hi)(rng); };
+    CommandStream stream; stream.reserve(count);
+    OrderId nextId = 1;
+    for (size_t i = 0; i < count; ++i) {
+        const int roll = static_cast<int>(uniform(0, 99));
+        const Side side = uniform(0, 1) ? Side::Buy : Side::Sell;
+        const Price price = static_cast<Price>(uniform(cfg.midPrice - cfg.priceSpread, cfg.midPrice + cfg.priceSpread));
+        const Quantity qty = static_cast<Quantity>(uniform(1, cfg.maxQuantity));
+        // cancels/modifies target any id issued so far; stale ids are part of the contract too
+        if (roll >= 100 - cfg.sessionPercent) {
+            stream.push_back({CommandType::Session, OrderType::GoodTillCancel, 0, side, 0, 0, SessionEvent(uniform(0, SessionEventCount - 1))});
+        } else if (roll >= 100 - 2 * cfg.sessionPercent && cfg.owners) {
+            stream.push_back({CommandType::CancelOwned, OrderType::GoodTillCancel, 0, side, 0, 0, SessionEvent{}, OwnerId(uniform(1, cfg.owners))});
+        } else if (nextId > 1 && roll < cfg.cancelPercent) {
+            stream.push_back({CommandType::Cancel, OrderType::GoodTillCancel, static_cast<OrderId>(uniform(1, nextId - 1)), side, 0, 0});
+        } else if (nextId > 1 && roll < cfg.cancelPercent + cfg.modifyPercent) {
+            stream.push_back({CommandType::Modify, OrderType::GoodTillCancel, static_cast<OrderId>(uniform(1, nextId - 1)), side, price, qty});
+        } else {
+            const int t = static_cast<int>(uniform(0, 99));
+            const OrderType type = t < 60 ? OrderType::GoodTillCancel : t < 75 ? OrderType::FillAndKill
+                                 : t < 85 ? OrderType::FillOrKill : t < 95 ? OrderType::GoodForDay : OrderType::Market;
+            // occasionally reuse an id to cover the duplicate path
+            const OrderId id = (nextId > 1 && uniform(0, 99) == 0) ? static_cast<OrderId>(uniform(1, nextId - 1)) : nextId++;
+            stream.push_back({CommandType::Add, type, id, side, price, qty, SessionEvent{}, cfg.owners ? OwnerId(uniform(1, cfg.owners)) : 0});
+        }
+    }
+    return stream;
+}
+
+// per-book settings that are not commands: every party that applies the same commands (the
+// sequencer's books, ReplaySequencedLog, ReplicationBackup, both engines of a differential run) must
+// start from the same ones, or their books accept and halt differently. Set them here rather than on
+// a running book
+struct BookConfig {
+    PriceLimits limits;
+    const InstrumentSpec* instrument = nullptr; // tick and lot tables; must outlive the books
+};
+using BookConfigs = std::vector<BookConfig>; // by book id; books past the end get the defaults
+
+template<class Book>
+void Configure(Book& book, const BookConfig& config) {
+    book.SetPriceLimits(config.limits);
+    book.SetInstrument(config.instrument);
+}
+
+// ----- differential harness -----
+// anything exposing the OrderBook command/query surface can be checked against the reference
+template<class Book>
+concept MatchingEngine = requires(Book b, const Book cb, const std::shared_ptr<Order>& order, OrderId id, const OrderModify& mod) {
+    { b.Submit(order) } -> std::same_as<OrderResult>;
+    { b.Cancel(id, OwnerId{}) } -> std::same_as<RejectReason>;
+    { b.Modify(mod, OwnerId{}) } -> std::same_as<OrderResult>;
+    { cb.GetBidLevels(size_t{}) } -> std::same_as<std::vector<std::pair<Price,uint64_t>>>;
+    { cb.GetAskLevels(size_t{}) } -> std::same_as<std::vector<std::pair<Price,uint64_t>>>;
+    { cb.Size() } -> std::convertible_to<size_t>;
+    { cb.StateHash() } -> std::same_as<uint64_t>;
+    { b.ApplySessionEvent(SessionEvent{}, TimePoint{}) } -> std::same_as<OrderResult>;
+    { b.CancelOwned(OwnerId{}) } -> std::same_as<size_t>;
+    { cb.QueueAhead(id) } -> std::same_as<std::optional<uint64_t>>;
+    { cb.QueueAheadByWalk(id) } -> std::same_as<std::optional<uint64_t>>;
+    { cb.GetTopOfBook() } -> std::same_as<TopOfBook>;
+    { cb.EstimateSweep(Side{}, Quantity{}) } -> std::same_as<SweepEstimate>;
+};
+
+// orders are mutated by the book, so every engine gets its own fresh instance; `at` stamps them
+// (the sequencer passes its own timestamp, so replays see the same times)
+template<MatchingEngine Book>
+OrderResult ApplyCommand(Book& book, const Command& c, TimePoint at = std::chrono::system_clock::now()) {
+    switch (c.type) {
+        case CommandType::Add:
+            if (c.orderType == OrderType::Market) return book.Submit(std::make_shared<Order>(c.orderType, c.id, c.side, Price{0}, c.quantity, at, c.owner));
+            return book.Submit(std::make_shared<Order>(c.orderType, c.id, c.side, c.price, c.quantity, at, c.owner));
+        case CommandType::Cancel:
+            return OrderResult{{}, book.Cancel(c.id, c.owner)};
+        case CommandType::Modify:
+            return book.Modify(OrderModify{c.id, c.side, c.price, c.quantity, at}, c.owner);
+        case CommandType::Session:
+            return book.ApplySessionEvent(c.session, at);
+        case CommandType::CancelOwned:
+            book.CancelOwned(c.owner);
+            return {};
+    }
+    return {};
+}
+
+struct Divergence {
+    size_t eventIndex;  // index of the first command after which the engines disagree
+    std::string what;
+};
+
+// replays the stream through both engines and compares trades, reject reasons, full-depth levels and Size() after every event,
+// plus the published top of book, a sweep of the command's quantity each way and, for every order it touched, each engine's
+// queue position against a walk of the reference's level
+template<MatchingEngine Reference, MatchingEngine Candidate>
+std::optional<Divergence> RunDifferential(const CommandStream& stream, const BookConfig& config = {}) {
+    Reference ref; Candidate cand;
+    Configure(ref, config); Configure(cand, config);
+    for (size_t i = 0; i < stream.size(); ++i) {
+        const TimePoint at = std::chrono::system_clock::now(); // one clock reading, so time-driven rules agree
+        const auto refResult = ApplyCommand(ref, stream[i], at);
+        const auto candResult = ApplyCommand(cand, stream[i], at);
+        if (refResult.trades != candResult.trades)
+            return Divergence{i, std::format("trades differ: reference produced {}, candidate produced {}", refResult.trades.size(), candResult.trades.size())};
+        if (refResult.reject != candResult.reject)
+            return Divergence{i, std::format("reject differs: reference '{}', candidate '{}'", RejectReasonName(refResult.reject), RejectReasonName(candResult.reject))};
+        if (ref.GetBidLevels(Reference::AllLevels) != cand.GetBidLevels(Candidate::AllLevels))
+            return Divergence{i, "bid levels differ"};
+        if (ref.GetAskLevels(Reference::AllLevels) != cand.GetAskLevels(Candidate::AllLevels))
+            return Divergence{i, "ask levels differ"};
+        if (ref.Size() != cand.Size())
+            return Divergence{i, std::format("size differs: reference {}, candidate {}", ref.Size(), cand.Size())};
+        if (ref.StateHash() != cand.StateHash())
+            return Divergence{i, "state hash differs"};
+        if (!(ref.GetTopOfBook() == cand.GetTopOfBook()))
+            return Divergence{i, "top of book differs"};
+        for (Side side : {Side::Buy, Side::Sell})
+            if (!(ref.EstimateSweep(side, stream[i].quantity) == cand.EstimateSweep(side, stream[i].quantity)))
+                return Divergence{i, std::format("{} sweep estimate differs", side == Side::Buy ? "buy" : "sell")};
+        auto queueDiffers = [&](OrderId id) -> std::optional<Divergence> {
+            const auto walked = ref.QueueAheadByWalk(id);
+            if (ref.QueueAhead(id) != walked) return Divergence{i, std::format("reference queue ahead of {} disagrees with its level", id)};
+            if (cand.QueueAhead(id) != walked) return Divergence{i, std::format("queue ahead of {} differs", id)};
+            return std::nullopt;
+        };
+        if (auto d = queueDiffers(stream[i].id)) return d;
+        for (const auto& t : refResult.trades)
+            for (OrderId id : {t.bid.orderId, t.ask.orderId})
+                if (auto d = queueDiffers(id)) return d;
+    }
+    return std::nullopt;
+}
+
+// delta debugging (ddmin): shrink a diverging stream to a 1-minimal one that still diverges
+template<MatchingEngine Reference, MatchingEngine Candidate>
+CommandStream MinimizeDivergence(CommandStream stream, const BookConfig& config = {}) {
+    auto diverges = [&](const CommandStream& s) { return RunDifferential<Reference, Candidate>(s, config).has_value(); };
+    const auto first = RunDifferential<Reference, Candidate>(stream, config);
+    if (!first) return stream;
+    stream.resize(first->eventIndex + 1); // nothing after the first divergence matters
+
+    size_t granularity = 2;
+    while (stream.size() >= 2) {
+        const size_t chunk = (stream.size() + granularity - 1) / granularity;
+        bool reduced = false;
+        for (size_t start = 0; start < stream.size(); start += chunk) {
+            CommandStream complement(stream.begin(), stream.begin() + start);
+            complement.insert(complement.end(), stream.begin() + std::min(start + chunk, stream.size()), stream.end());
+            if (diverges(complement)) {
+                stream = std::move(complement);
+                granularity = std::max<size_t>(granularity - 1, 2);
+                reduced = true;
+                break;
+            }
+        }
+        if (!reduced) {
+            if (granularity >= stream.size()) break;
+            granularity = std::min(stream.size(), granularity * 2);
+        }
+    }
+    return stream;
+}
+
+// runs one stream and, on failure, prints the divergence and the minimized reproducer
+template<MatchingEngine Reference, MatchingEngine Candidate>
+bool CheckEquivalent(const CommandStream& stream, const char* candidateName, const BookConfig& config = {}, std::ostream& os = std::cout) {
+    const auto divergence = RunDifferential<Reference, Candidate>(stream, config);
+    if (!divergence) return true;
+    os << std::format("[{}] diverged at event {}: {}\n", candidateName, divergence->eventIndex, divergence->what);
+    const auto minimal = MinimizeDivergence<Reference, Candidate>(stream, config);
+    os << std::format("[{}] minimized reproducer ({} commands):\n", candidateName, minimal.size());
+    SaveCommands(os, minimal);
+    return false;
+}
+
+// ParseFixed against FormatFixed: random values of every magnitude and precision read back exactly,
+// and malformed text is refused. Prints each failure
+inline bool CheckDecimalText(uint64_t seed, size_t count, std::ostream& os = std::cout) {
+    std::mt19937_64 rng(seed);
+    bool ok = true;
+    char buf[24];
+    for (size_t i = 0; i < count; ++i) {
+        const unsigned decimals = unsigned(rng() % 9);
+        const int64_t magnitude = int64_t(rng() % uint64_t(detail::Pow10[rng() % 19]));
+        const int64_t value = rng() & 1 ? -magnitude : magnitude;
+        const std::string_view text(buf, FormatFixed(buf, value, decimals));
+        if (const auto back = ParseFixed(text, decimals); back != value) {
+            os << std::format("[decimal] '{}' at {} decimals read back as {}\n", text, decimals, back ? std::to_string(*back) : "nothing");
+            ok = false;
+        }
+    }
+    for (std::string_view bad : {"", "-", ".", "-.", "--1", "+1", " 1", "1 ", "12x", "1.2.3", "1.5x", "1e3", "0x10", "1234567890123456789"})
+        if (ParseFixed(bad, 0) || ParseFixed(bad, 4)) { os << std::format("[decimal] accepted '{}'\n", bad); ok = false; }
+    if (ParseFixed("1.25", 1) || ParseFixed("100000000000000.0001", 4)) { os << "[decimal] accepted excess digits\n"; ok = false; }
+    if (ParseFixed("1.50", 1) != 15 || ParseFixed("-0.0700", 2) != -7 || ParseFixed(".5", 1) != 5) { os << "[decimal] misread padded text\n"; ok = false; }
+    return ok;
+}
+
+// every (state, event) pair on a fresh book: legal ones land where SessionTransitions says, the rest
+// are refused and leave the state and the orders alone. Prints each failure
+template<MatchingEngine Book = OrderBook>
+bool CheckSessionTransitions(std::ostream& os = std::cout) {
+    using enum SessionEvent;
+    const std::pair<SessionState, std::vector<SessionEvent>> paths[] = {
+        {SessionState::Continuous, {}}, {SessionState::Halted, {Halt}}, {SessionState::ClosingAuction, {ClosingAuction}},
+        {SessionState::Closed, {Close}}, {SessionState::PreOpen, {Close, PreOpen}}, {SessionState::OpeningAuction, {Close, PreOpen, OpeningAuction}},
+    };
+    bool ok = true;
+    for (const auto& [from, path] : paths) {
+        for (uint8_t e = 0; e < SessionEventCount; ++e) {
+            Book book;
+            for (SessionEvent step : path) book.ApplySessionEvent(step, TimePoint{});
+            book.Submit(std::make_shared<Order>(OrderType::GoodTillCancel, 1, Side::Buy, 100, 10, TimePoint{}));
+            const auto expected = StateAfter(from, SessionEvent(e));
+            const auto result = book.ApplySessionEvent(SessionEvent(e), TimePoint{});
+            const bool refused = result.reject == RejectReason::NotAllowedInSession;
+            if (book.GetSessionState() != expected.value_or(from) || refused == expected.has_value() || (refused && book.Size() != size_t(from != SessionState::Closed))) {
+                os << std::format("[session] {} from {}: now {}, {}\n", SessionEventName(SessionEvent(e)), SessionStateName(from),
+                                  SessionStateName(book.GetSessionState()), refused ? "refused" : "applied");
+                ok = false;
+            }
+        }
+    }
+    // a halt cannot reopen a closed book to resting orders
+    Book closed;
+    closed.ApplySessionEvent(Close, TimePoint{});
+    closed.ApplySessionEvent(Halt, TimePoint{});
+    if (closed.Submit(std::make_shared<Order>(OrderType::GoodTillCancel, 1, Side::Buy, 100, 10, TimePoint{})).reject != RejectReason::NotAllowedInSession) {
+        os << "[session] a halted closed book accepted an order\n";
+        ok = false;
+    }
+    return ok;
+}
+
+// ----- sequencer -----
+// a command as the sequencer let it through: its place in the total order across all books, when,
+// and which book it is for. The log of these is the system of record; replaying it reproduces every trade.
+struct SequencedCommand {
+    uint64_t sequence = 0;
+    int64_t timestamp = 0; // ns since epoch, stamped by the sequencer
+    uint32_t book = 0;
+    Command command{};
+    TimePoint At() const noexcept { return TimePoint(std::chrono::duration_cast<TimePoint::duration>(std::chrono::nanoseconds(timestamp))); }
+};
+using SequencedLog = std::vector<SequencedCommand>;
+
+// text form: "<sequence> <timestamp> <book> " followed by the command's own text form
+inline void SaveSequencedLog(std::ostream& os, const SequencedLog& log) {
+    for (const auto& s : log) os << s.sequence << ' ' << s.timestamp << ' ' << s.book << ' ' << s.command << '\n';
+}
+
+inline SequencedLog LoadSequencedLog(std::istream& is) {
+    SequencedLog log;
+    std::string line;
+    while (std::getline(is, line)) {
+        std::istringstream in(line);
+        SequencedCommand s;
+        if (!(in >> s.sequence >> s.timestamp >> s.book)) continue;
+        auto c = ParseCommand(in, line);
+        if (!c) throw std::runtime_error(std::format("malformed log line: {}", line));
+        s.command = *c;
+        log.push_back(s);
+    }
+    return log;
+}
+
+// bounded multi-producer single-consumer queue (Vyukov): producers claim a cell with one CAS on the
+// head and publish it through the cell's own sequence, so they never wait on each other's copies
+template<class T, size_t N>
+    requires (std::has_single_bit(N) && std::is_trivially_copyable_v<T>)
+class MpscQueue {
+public:
+    MpscQueue() : cells_(std::make_unique<Cell[]>(N)) {
+        for (size_t i = 0; i < N; ++i) cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    // any thread; false if the queue is full
+    bool TryPush(const T& value) noexcept {
+        uint64_t pos = head_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells_[pos & (N - 1)];
+            const int64_t diff = int64_t(cell.sequence.load(std::memory_order_acquire)) - int64_t(pos);
+            if (diff == 0 && head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                cell.value = value;
+                cell.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+            if (diff < 0) return false;
+            if (diff > 0) pos = head_.load(std::memory_order_relaxed);
+        }
+    }
+
+    // the consumer thread only
+    bool TryPop(T& value) noexcept {
+        Cell& cell = cells_[tail_ & (N - 1)];
+        if (cell.sequence.load(std::memory_order_acquire) != tail_ + 1) return false;
+        value = cell.value;
+        cell.sequence.store(tail_ + N, std::memory_order_release);
+        ++tail_;
+        return true;
+    }
+
+private:
+    struct Cell { std::atomic<uint64_t> sequence; T value; };
+    std::unique_ptr<Cell[]> cells_;
+    alignas(64) std::atomic<uint64_t> head_{0};
+    alignas(64) uint64_t tail_ = 0;
+};
+
+// idle policy for the stage threads below: spin briefly, then sleep so an idle stage costs no core
+struct Backoff {
+    uint32_t idle = 0;
+    void Reset() noexcept { idle = 0; }
+    void Wait() noexcept {
+        if (++idle < 64) std::this_thread::yield();
+        else std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+};
+
+// fingerprint of a book's resting orders; primary and backup compare these at the same log sequence
+template<class Book>
+uint64_t BookChecksum(const Book& book) { return book.StateHash(); }
+
+// optional observers of the sequenced flow, fixed when the sequencer is built
+struct SequencerTaps {
+    std::function<void(const SequencedCommand&)> journal; // sequencer thread, after stamping, before the shard sees it
+    uint64_t checksumEvery = 0;                            // 0: never
+    std::function<void(uint64_t sequence, uint32_t book, uint64_t checksum)> checksum; // shard thread, after applying
+    bool keepLog = true; // in-memory copy behind Sequencer::Log(); grows without bound, so turn it off
+                         // for long runs and let the journal be the record
+};
+
+template<class Book>
+std::vector<std::unique_ptr<Book>> MakeBooks(uint32_t count, const BookConfigs& configs) {
+    std::vector<std::unique_ptr<Book>> books;
+    for (uint32_t i = 0; i < count; ++i) {
+        auto& book = books.emplace_back(std::make_unique<Book>());
+        if (i < configs.size()) Configure(*book, configs[i]);
+    }
+    return books;
+}
+
+// someone waiting on one command's result. Complete runs on the shard thread right after the command
+// is applied, so it should only hand the result on (see AsyncClient)
+struct CommandCompletion {
+    virtual void Complete(const SequencedCommand& s, const OrderResult& result) noexcept = 0;
+protected:
+    ~CommandCompletion() = default;
+};
+
+// one shard's thread and the books it owns; commands reach it over an SPSC ring from the sequencer
+// already in their final order, so each book sees exactly the order recorded in the log
+template<class Book>
+class BookShard {
+public:
+    using ResultHandler = std::function<void(const SequencedCommand&, const OrderResult&)>;
+
+    BookShard(const ResultHandler& onResult, const SequencerTaps& taps) : onResult_(onResult), taps_(taps), thread_([this] { Run(); }) {}
+    ~BookShard() { stop_.store(true); thread_.join(); }
+
+    BookShard(const BookShard&) = delete;
+    BookShard& operator=(const BookShard&) = delete;
+
+    // sequencer thread only; the book must have been added before the shard sees commands for it
+    void Push(const SequencedCommand& s, CommandCompletion* done = nullptr) noexcept {
+        for (Backoff backoff; !ring_->TryPush(Item{s, done});) backoff.Wait();
+        pushed_.store(s.sequence, std::memory_order_release);
+    }
+    void AddBook(uint32_t id, Book* book) { books_.emplace(id, book); }
+
+    // sequence of the last command handed to / applied by this shard
+    uint64_t Pushed() const noexcept { return pushed_.load(std::memory_order_acquire); }
+    uint64_t Applied() const noexcept { return applied_.load(std::memory_order_acquire); }
+
+private:
+    struct Item { SequencedCommand command; CommandCompletion* done; };
+    std::unique_ptr<SpscRing<Item, 1 << 12>> ring_ = std::make_unique<SpscRing<Item, 1 << 12>>();
+    std::unordered_map<uint32_t, Book*> books_;
+    const ResultHandler& onResult_;
+    const SequencerTaps& taps_;
+    std::atomic<bool> stop_{false};
+    std::atomic<uint64_t> pushed_{0}, applied_{0};
+    std::thread thread_;
+
+    void Run() {
+        Item item;
+        for (Backoff backoff;;) {
+            if (ring_->TryPop(item)) {
+                backoff.Reset();
+                const SequencedCommand& s = item.command;
+                Book& book = *books_.at(s.book);
+                const OrderResult result = ApplyCommand(book, s.command, s.At());
+                if (onResult_) onResult_(s, result);
+                if (item.done) item.done->Complete(s, result);
+                if (taps_.checksumEvery && s.sequence % taps_.checksumEvery == 0) taps_.checksum(s.sequence, s.book, BookChecksum(book));
+                applied_.store(s.sequence, std::memory_order_release);
+                continue;
+            }
+            if (stop_.load()) return;
+            backoff.Wait();
+        }
+    }
+};
+
+// front of the engine: any thread submits commands for any book; the sequencer thread takes them in
+// queue order, stamps a global sequence and timestamp, appends them to the log and hands each to the
+// shard owning its book. The total order no longer depends on which thread wins a book's mutex.
+// Session events are commands like any other, so they are in the log and replay in place.
+template<class Book = OrderBook>
+class Sequencer {
+public:
+    using ResultHandler = typename BookShard<Book>::ResultHandler;
+
+    // books are numbered 0..books-1 and book i lives on shard i % shards
+    Sequencer(uint32_t books, uint32_t shards, ResultHandler onResult = {}, SequencerTaps taps = {}, const BookConfigs& configs = {})
+        : Sequencer(MakeBooks<Book>(books, configs), shards, 0, std::move(onResult), std::move(taps)) {}
+
+    // take over books already brought up to lastSequence, e.g. a promoted backup's
+    Sequencer(std::vector<std::unique_ptr<Book>> books, uint32_t shards, uint64_t lastSequence, ResultHandler onResult = {}, SequencerTaps taps = {})
+        : onResult_(std::move(onResult)), taps_(std::move(taps)), books_(std::move(books)), sequence_(lastSequence) {
+        for (uint32_t i = 0; i < shards; ++i) shards_.push_back(std::make_unique<BookShard<Book>>(onResult_, taps_));
+        for (uint32_t i = 0; i < books_.size(); ++i) shards_[i % shards]->AddBook(i, books_[i].get());
+        thread_ = std::thread([this] { Run(); });
+    }
+
+    ~Sequencer() {
+        stop_.store(true);
+        thread_.join();
+        shards_.clear(); // shards drain their rings before their threads exit
+    }
+
+    Sequencer(const Sequencer&) = delete;
+    Sequencer& operator=(const Sequencer&) = delete;
+
+    // any thread; waits only while the inbound queue is full. done, if given, is told the result
+    // on the shard thread, after the result handler
+    void Submit(uint32_t book, const Command& command, CommandCompletion* done = nullptr) noexcept {
+        assert(book < books_.size());
+        for (Backoff backoff; !inbound_.TryPush(Inbound{book, command, done});) backoff.Wait();
+        submitted_.fetch_add(1, std::memory_order_release);
+    }
+
+    // block until everything submitted so far has been applied to its book
+    void Drain() const {
+        const uint64_t target = submitted_.load(std::memory_order_acquire);
+        for (Backoff backoff; sequenced_.load(std::memory_order_acquire) < target;) backoff.Wait();
+        for (const auto& shard : shards_)
+            for (Backoff backoff; shard->Applied() < shard->Pushed();) backoff.Wait();
+    }
+
+    // session events for every book, each sequenced and applied on the book's shard; for SessionScheduler::Add
+    std::function<void(SessionEvent)> SessionSink() {
+        return [this](SessionEvent event) {
+            for (uint32_t book = 0; book < books_.size(); ++book)
+                Submit(book, Command{CommandType::Session, OrderType::GoodTillCancel, 0, Side::Buy, 0, 0, event});
+        };
+    }
+
+    // cancel-on-disconnect: one sequenced CancelOwned per book
+    void CancelOwned(OwnerId owner) noexcept {
+        for (uint32_t book = 0; book < books_.size(); ++book)
+            Submit(book, Command{CommandType::CancelOwned, OrderType::GoodTillCancel, 0, Side::Buy, 0, 0, SessionEvent{}, owner});
+    }
+
+    Book& GetBook(uint32_t book) noexcept { return *books_[book]; }
+    size_t BookCount() const noexcept { return books_.size(); }
+
+    // the log so far (empty unless taps.keepLog); call after Drain, or with submissions stopped
+    const SequencedLog& Log() const noexcept { return log_; }
+
+private:
+    struct Inbound { uint32_t book; Command command; CommandCompletion* done; };
+
+    ResultHandler onResult_;
+    SequencerTaps taps_;
+    std::vector<std::unique_ptr<Book>> books_;
+    std::vector<std::unique_ptr<BookShard<Book>>> shards_;
+    MpscQueue<Inbound, 1 << 14> inbound_;
+    SequencedLog log_;
+    uint64_t sequence_; // sequencer thread only
+    std::atomic<uint64_t> submitted_{0}, sequenced_{0}; // commands taken in / stamped by this sequencer, from 0 whatever lastSequence was
+    std::atomic<bool> stop_{false};
+    std::thread thread_;
+
+    void Run() {
+        Inbound in;
+        for (Backoff backoff;;) {
+            if (inbound_.TryPop(in)) {
+                backoff.Reset();
+                const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+                const SequencedCommand s{++sequence_, now, in.book, in.command};
+                if (taps_.keepLog) log_.push_back(s);
+                if (taps_.journal) taps_.journal(s);
+                shards_[in.book % shards_.size()]->Push(s, in.done);
+                sequenced_.fetch_add(1, std::memory_order_release);
+                continue;
+            }
+            if (stop_.load()) return;
+            backoff.Wait();
+        }
+    }
+};
+
+// rebuilds books from a log on the calling thread, in log order, reporting each result as the
+// shards did; with the same log and configs the trades and rejects are identical to the live run
+template<class Book = OrderBook>
+std::vector<std::unique_ptr<Book>> ReplaySequencedLog(const SequencedLog& log, uint32_t books,
+        const std::function<void(const SequencedCommand&, const OrderResult&)>& onResult = {}, const BookConfigs& configs = {}) {
+    auto out = MakeBooks<Book>(books, configs);
+    for (const auto& s : log) {
+        const OrderResult result = ApplyCommand(*out.at(s.book), s.command, s.At());
+        if (onResult) onResult(s, result);
+    }
+    return out;
+}
+
+// ----- client sessions -----
+// token bucket: refills at `rate` per second up to `burst`; O(1) per message with the caller's clock reading
+class TokenBucket {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    TokenBucket(double ratePerSecond, uint32_t burst, Clock::time_point now = Clock::now())
+        : rate_(ratePerSecond / 1e9), burst_(burst), tokens_(burst), last_(now) {}
+
+    bool TryTake(Clock::time_point now) noexcept {
+        tokens_ = std::min(burst_, tokens_ + double(std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_).count()) * rate_);
+        last_ = now;
+        if (tokens_ < 1) return false;
+        tokens_ -= 1;
+        return true;
+    }
+
+private:
+    double rate_; // tokens per nanosecond
+    double burst_, tokens_;
+    Clock::time_point last_;
+};
+
+struct SessionLimits {
+    double messagesPerSecond = 10000;
+    uint32_t burst = 1000;
+    bool cancelOnDisconnect = true;
+};
+
+// one connected client in front of a Sequencer, used from that client's gateway thread. Its
+// commands are throttled before they are queued, so a client flooding adds costs only itself;
+// its adds are tagged with its owner id, its cancels and modifies reach only orders carrying that
+// id, and disconnecting cancels what it left resting across every book (each book walks only that
+// owner's orders)
+template<class Book = OrderBook>
+class ClientSession {
+public:
+    ClientSession(Sequencer<Book>& sequencer, OwnerId owner, SessionLimits limits = {})
+        : sequencer_(sequencer), owner_(owner), limits_(limits), bucket_(limits.messagesPerSecond, limits.burst) { assert(owner != 0); }
+
+    ~ClientSession() { Disconnect(); }
+
+    ClientSession(const ClientSession&) = delete;
+    ClientSession& operator=(const ClientSession&) = delete;
+
+    // NotPermitted for anything but adds, cancels and modifies, Throttled (nothing queued) over the
+    // rate, UnknownOrderId after Disconnect; otherwise the command is queued and its result arrives
+    // through the sequencer's handler (and `done`). Ownership is checked by the book when the command
+    // applies: another owner's order comes back as NotPermitted, one no longer resting as UnknownOrderId
+    RejectReason Submit(uint32_t book, Command command, CommandCompletion* done = nullptr) noexcept {
+        if (!connected_) return RejectReason::UnknownOrderId;
+        if (command.type != CommandType::Add && command.type != CommandType::Cancel && command.type != CommandType::Modify) return RejectReason::NotPermitted;
+        if (!bucket_.TryTake(TokenBucket::Clock::now())) { ++throttled_; return RejectReason::Throttled; }
+        command.owner = owner_;
+        sequencer_.Submit(book, command, done);
+        return RejectReason::None;
+    }
+
+    // not throttled; idempotent
+    void Disconnect() noexcept {
+        if (!std::exchange(connected_, false)) return;
+        if (limits_.cancelOnDisconnect) sequencer_.CancelOwned(owner_);
+    }
+
+    OwnerId Owner() const noexcept { return owner_; }
+    uint64_t Throttled() const noexcept { return throttled_; }
+    Sequencer<Book>& GetSequencer() const noexcept { return sequencer_; }
+
+private:
+    Sequencer<Book>& sequencer_;
+    OwnerId owner_;
+    SessionLimits limits_;
+    TokenBucket bucket_;
+    bool connected_ = true;
+    uint64_t throttled_ = 0;
+};
+
+// ----- coroutine client -----
+// fire-and-forget coroutine for strategy and simulation code: runs at once up to its first
+// suspension and frees itself when it finishes; an escaping exception terminates
+struct AsyncTask {
+    struct promise_type {
+        AsyncTask get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+// awaitable commands for any number of coroutines on one thread:
+//   auto result = co_await client.Submit(book, order);
+// The command goes through the sequencer like any other; the shard that applies it queues the
+// coroutine back to this client, and RunReady, called from the client's own loop, resumes it with
+// the result. No thread waits on any one request. Built over a ClientSession, commands are throttled
+// and owned by that session; a command it refuses, or one over MaxInFlight awaited at once, resumes
+// at once with the reject (Throttled for the latter) without reaching the sequencer.
+template<class Book = OrderBook>
+class AsyncClient {
+public:
+    static constexpr size_t MaxInFlight = 1 << 12;
+
+    class [[nodiscard]] Awaiter : CommandCompletion {
+    public:
+        Awaiter(AsyncClient& client, uint32_t book, const Command& command) : client_(client), book_(book), command_(command) {}
+        Awaiter(const Awaiter&) = delete;
+        Awaiter& operator=(const Awaiter&) = delete;
+
+        bool await_ready() noexcept {
+            if (client_.pending_ < MaxInFlight) return false;
+            result_.reject = RejectReason::Throttled;
+            return true;
+        }
+        // once the command is queued the shard thread owns result_ until RunReady resumes us
+        bool await_suspend(std::coroutine_handle<> handle) noexcept {
+            handle_ = handle;
+            ++client_.pending_;
+            if (!client_.session_) { client_.sequencer_.Submit(book_, command_, this); return true; }
+            const RejectReason refused = client_.session_->Submit(book_, command_, this);
+            if (refused == RejectReason::None) return true;
+            --client_.pending_;
+            result_.reject = refused; // nothing was queued
+            return false;
+        }
+        OrderResult await_resume() noexcept { return std::move(result_); }
+
+    private:
+        friend class AsyncClient;
+        AsyncClient& client_;
+        uint32_t book_;
+        Command command_;
+        std::coroutine_handle<> handle_;
+        OrderResult result_;
+
+        // shard thread
+        void Complete(const SequencedCommand&, const OrderResult& result) noexcept override {
+            result_ = result;
+            for (Backoff backoff; !client_.ready_.TryPush(this);) backoff.Wait();
+        }
+    };
+
+    explicit AsyncClient(Sequencer<Book>& sequencer, OwnerId owner = 0) : sequencer_(sequencer), owner_(owner) {}
+    explicit AsyncClient(ClientSession<Book>& session) : sequencer_(session.GetSequencer()), session_(&session), owner_(session.Owner()) {}
+    AsyncClient(const AsyncClient&) = delete;
+    AsyncClient& operator=(const AsyncClient&) = delete;
+    ~AsyncClient() { assert(pending_ == 0 && "coroutines still waiting on this client"); }
+
+    // every command carries this client's owner, so the book applies the ownership checks
+    Awaiter Submit(uint32_t book, Command command) {
+        command.owner = owner_;
+        return Awaiter(*this, book, command);
+    }
+    Awaiter Submit(uint32_t book, const Order& order) {
+        return Submit(book, Command{CommandType::Add, order.GetOrderType(), order.GetOrderId(), order.GetSide(), order.GetPrice(), order.GetInitialQuantity()});
+    }
+    Awaiter Cancel(uint32_t book, OrderId id) { return Submit(book, Command{CommandType::Cancel, OrderType::GoodTillCancel, id, Side::Buy, 0, 0}); }
+    Awaiter Modify(uint32_t book, const OrderModify& mod) {
+        return Submit(book, Command{CommandType::Modify, OrderType::GoodTillCancel, mod.GetOrderId(), mod.GetSide(), mod.GetPrice(), mod.GetQuantity()});
+    }
+
+    // resume, on the calling thread, every coroutine whose result has arrived; returns how many
+    size_t RunReady() {
+        size_t count = 0;
+        for (Awaiter* done; ready_.TryPop(done); ++count) {
+            --pending_;
+            done->handle_.resume(); // may destroy *done along with its frame
+        }
+        return count;
+    }
+
+    size_t Pending() const noexcept { return pending_; }
+
+private:
+    Sequencer<Book>& sequencer_;
+    ClientSession<Book>* session_ = nullptr; // when set, commands go through it instead of straight to sequencer_
+    OwnerId owner_;
+    MpscQueue<Awaiter*, MaxInFlight> ready_; // shards push, RunReady pops
+    size_t pending_ = 0;                     // client thread only
+};
+
+// one command from outside any coroutine: `out` is set once RunReady has resumed it
+template<class Book>
+AsyncTask AwaitResult(AsyncClient<Book>& client, uint32_t book, Command command, std::optional<OrderResult>& out) {
+    out = co_await client.Submit(book, command);
+}
+
+// a client cancels and modifies only its own orders; another owner's are refused and left resting
+inline bool CheckAsyncOwnership(std::ostream& os = std::cout) {
+    Sequencer<OrderBook> sequencer(1, 1);
+    AsyncClient<OrderBook> maker(sequencer, 7), other(sequencer, 9);
+    auto run = [](AsyncClient<OrderBook>& client, const Command& command) {
+        std::optional<OrderResult> result;
+        AwaitResult(client, 0, command, result);
+        for (Backoff backoff; !result; backoff.Wait()) client.RunReady();
+        return result->reject;
+    };
+    const Command add{CommandType::Add, OrderType::GoodTillCancel, 1, Side::Buy, 100, 10};
+    const Command cancel{CommandType::Cancel, OrderType::GoodTillCancel, 1, Side::Buy, 0, 0};
+    const Command modify{CommandType::Modify, OrderType::GoodTillCancel, 1, Side::Buy, 101, 5};
+    const bool ok = run(maker, add) == RejectReason::None
+        && run(other, cancel) == RejectReason::NotPermitted && run(other, modify) == RejectReason::NotPermitted
+        && sequencer.GetBook(0).GetBidLevels() == std::vector<std::pair<Price,uint64_t>>{{100, 10}}
+        && run(maker, modify) == RejectReason::None && run(maker, cancel) == RejectReason::None;
+    if (!ok) os << "[async] another owner's cancel or modify was not refused\n";
+    return ok;
+}
+
+// ----- replication -----
+// one unit on the primary-to-backup stream: the opening Hello (checksum holds the checksum
+// interval), a sequenced command, or the primary's checksum of one book right after a sequence.
+// Sent as raw bytes, so both ends must be the same build on the same host
+struct ReplicationFrame {
+    enum class Kind : uint8_t { Hello, Command, Checksum };
+    Kind kind = Kind::Command;
+    SequencedCommand command{};
+    uint64_t checksum = 0;
+};
+
+namespace detail {
+// "unix:<path>" or "<IPv4>:<port>"
+struct StreamEndpoint {
+    sockaddr_storage addr{};
+    socklen_t length = 0;
+    bool local = false; // AF_UNIX
+};
+
+inline StreamEndpoint ParseStreamEndpoint(const std::string& endpoint) {
+    StreamEndpoint out;
+    if (endpoint.starts_with("unix:")) {
+        auto& un = reinterpret_cast<sockaddr_un&>(out.addr);
+        const std::string path = endpoint.substr(5);
+        if (path.size() >= sizeof(un.sun_path)) throw std::invalid_argument(std::format("socket path too long: {}", path));
+        un.sun_family = AF_UNIX;
+        std::memcpy(un.sun_path, path.c_str(), path.size() + 1);
+        out.length = sizeof(sockaddr_un); out.local = true;
+        return out;
+    }
+    const auto colon = endpoint.rfind(':');
+    if (colon == std::string::npos) throw std::invalid_argument(std::format("bad endpoint: {}", endpoint));
+    reinterpret_cast<sockaddr_in&>(out.addr) = UdpEndpoint(endpoint.substr(0, colon), uint16_t(std::stoul(endpoint.substr(colon + 1))));
+    out.length = sizeof(sockaddr_in);
+    return out;
+}
+
+inline int StreamSocket(const StreamEndpoint& e) {
+    const int fd = ::socket(e.local ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) throw std::system_error(errno, std::generic_category(), "socket");
+    const int on = 1;
+    if (!e.local) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return fd;
+}
+
+inline bool WriteAll(int fd, const void* data, size_t size) {
+    for (auto p = static_cast<const char*>(data); size;) {
+        const ssize_t n = ::send(fd, p, size, MSG_NOSIGNAL);
+        if (n <= 0) { if (n < 0 && errno == EINTR) continue; return false; }
+        p += n; size -= size_t(n);
+    }
+    return true;
+}
+
+inline bool ReadAll(int fd, void* data, size_t size) {
+    for (auto p = static_cast<char*>(data); size;) {
+        const ssize_t n = ::recv(fd, p, size, 0);
+        if (n <= 0) { if (n < 0 && errno == EINTR) continue; return false; }
+        p += n; size -= size_t(n);
+    }
+    return true;
+}
+} // namespace detail
+
+// ships a sequencer's log to a backup. Build it first and hand Taps() to the Sequencer; the journal
+// tap and the shards' checksum taps feed one MPSC queue that a sender thread drains onto the socket.
+// The queue is the only buffer, so a backup that stops reading eventually holds the sequencer back
+// rather than letting the two drift. Attach before the first command: the backup starts from empty books.
+class ReplicationPrimary {
+public:
+    ReplicationPrimary(const std::string& endpoint, uint64_t checksumEvery = 1024) : checksumEvery_(checksumEvery) {
+        const auto e = detail::ParseStreamEndpoint(endpoint);
+        fd_ = detail::StreamSocket(e);
+        if (::connect(fd_, reinterpret_cast<const sockaddr*>(&e.addr), e.length) < 0) {
+            const int err = errno; ::close(fd_);
+            throw std::system_error(err, std::generic_category(), std::format("connect {}", endpoint));
+        }
+        const ReplicationFrame hello{ReplicationFrame::Kind::Hello, {}, checksumEvery_};
+        if (!detail::WriteAll(fd_, &hello, sizeof(hello))) {
+            const int err = errno; ::close(fd_);
+            throw std::system_error(err, std::generic_category(), "replication hello");
+        }
+        thread_ = std::thread([this] { Run(); });
+    }
+
+    // the sequencer must be destroyed before the primary
+    ~ReplicationPrimary() {
+        stop_.store(true);
+        thread_.join();
+        ::close(fd_);
+    }
+
+    ReplicationPrimary(const ReplicationPrimary&) = delete;
+    ReplicationPrimary& operator=(const ReplicationPrimary&) = delete;
+
+    SequencerTaps Taps() {
+        return SequencerTaps{
+            [this](const SequencedCommand& s) { Push(ReplicationFrame{ReplicationFrame::Kind::Command, s, 0}); },
+            checksumEvery_,
+            [this](uint64_t sequence, uint32_t book, uint64_t sum) {
+                Push(ReplicationFrame{ReplicationFrame::Kind::Checksum, SequencedCommand{sequence, 0, book, {}}, sum});
+            }};
+    }
+
+    bool Connected() const noexcept { return !failed_.load(); }
+
+private:
+    int fd_ = -1;
+    uint64_t checksumEvery_;
+    MpscQueue<ReplicationFrame, 1 << 14> queue_;
+    std::atomic<bool> stop_{false}, failed_{false};
+    std::thread thread_;
+
+    void Push(const ReplicationFrame& frame) noexcept {
+        for (Backoff backoff; !queue_.TryPush(frame);) { if (failed_.load()) return; backoff.Wait(); }
+    }
+
+    void Run() {
+        std::vector<ReplicationFrame> batch;
+        ReplicationFrame frame;
+        for (Backoff backoff;;) {
+            while (batch.size() < 256 && queue_.TryPop(frame)) batch.push_back(frame);
+            if (!batch.empty()) {
+                backoff.Reset();
+                if (!failed_.load() && !detail::WriteAll(fd_, batch.data(), batch.size() * sizeof(ReplicationFrame))) failed_.store(true);
+                batch.clear();
+                continue;
+            }
+            if (stop_.load()) return;
+            backoff.Wait();
+        }
+    }
+};
+
+// hot standby: listens for one primary, applies its log to local books in order on a receiver
+// thread and checks each primary checksum against its own books at the same sequence. Promote
+// hands the warm books to a new Sequencer that continues the numbering, so failover costs a thread
+// start rather than a rebuild.
+template<class Book = OrderBook>
+class ReplicationBackup {
+public:
+    // configs: the primary's, so both sides accept, reject and halt alike
+    ReplicationBackup(const std::string& endpoint, uint32_t books, const BookConfigs& configs = {}) : books_(MakeBooks<Book>(books, configs)) {
+        const auto e = detail::ParseStreamEndpoint(endpoint);
+        listen_ = detail::StreamSocket(e);
+        const int on = 1;
+        setsockopt(listen_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (e.local) ::unlink(reinterpret_cast<const sockaddr_un&>(e.addr).sun_path);
+        if (::bind(listen_, reinterpret_cast<const sockaddr*>(&e.addr), e.length) < 0 || ::listen(listen_, 1) < 0) {
+            const int err = errno; ::close(listen_);
+            throw std::system_error(err, std::generic_category(), std::format("listen {}", endpoint));
+        }
+        thread_ = std::thread([this] { Run(); });
+    }
+
+    ~ReplicationBackup() { Stop(); }
+
+    ReplicationBackup(const ReplicationBackup&) = delete;
+    ReplicationBackup& operator=(const ReplicationBackup&) = delete;
+
+    uint64_t AppliedSequence() const noexcept { return applied_.load(std::memory_order_acquire); }
+    uint64_t ChecksumsMatched() const noexcept { return matched_.load(); }
+    uint64_t ChecksumMismatches() const noexcept { return mismatched_.load(); }
+    bool PrimaryLost() const noexcept { return lost_.load(); } // the stream ended
+
+    // stop following the primary and run the books as the new primary
+    std::unique_ptr<Sequencer<Book>> Promote(uint32_t shards, typename Sequencer<Book>::ResultHandler onResult = {}, SequencerTaps taps = {}) {
+        Stop();
+        return std::make_unique<Sequencer<Book>>(std::move(books_), shards, applied_.load(), std::move(onResult), std::move(taps));
+    }
+
+    // read access while following; the books are written only by the receiver thread
+    const Book& GetBook(uint32_t book) const noexcept { return *books_[book]; }
+
+private:
+    std::vector<std::unique_ptr<Book>> books_;
+    int listen_ = -1;
+    std::atomic<int> conn_{-1};
+    std::atomic<uint64_t> applied_{0}, matched_{0}, mismatched_{0};
+    std::atomic<bool> lost_{false}, stopped_{false};
+    std::thread thread_;
+    uint64_t checksumEvery_ = 0;
+    std::unordered_map<uint64_t, uint64_t> mine_, theirs_; // checksums by sequence waiting for the other side's
+
+    void Stop() {
+        if (stopped_.exchange(true)) return;
+        ::shutdown(listen_, SHUT_RDWR);
+        if (const int fd = conn_.load(); fd >= 0) ::shutdown(fd, SHUT_RDWR);
+        thread_.join();
+        ::close(listen_);
+        if (const int fd = conn_.load(); fd >= 0) ::close(fd);
+    }
+
+    // pair up the two sides' checksums for one sequence, whichever arrives first
+    void Match(std::unordered_map<uint64_t, uint64_t>& other, std::unordered_map<uint64_t, uint64_t>& own, uint64_t sequence, uint64_t sum) {
+        auto it = other.find(sequence);
+        if (it == other.end()) { own.emplace(sequence, sum); return; }
+        (it->second == sum ? matched_ : mismatched_).fetch_add(1);
+        other.erase(it);
+    }
+
+    void Run() {
+        const int fd = ::accept(listen_, nullptr, nullptr);
+        if (fd < 0) { lost_.store(true); return; }
+        conn_.store(fd);
+        if (stopped_.load()) ::shutdown(fd, SHUT_RDWR); // Stop raced the accept
+        ReplicationFrame frame;
+        while (detail::ReadAll(fd, &frame, sizeof(frame))) {
+            const SequencedCommand& s = frame.command;
+            switch (frame.kind) {
+                case ReplicationFrame::Kind::Hello: checksumEvery_ = frame.checksum; break;
+                case ReplicationFrame::Kind::Checksum: Match(mine_, theirs_, s.sequence, frame.checksum); break;
+                case ReplicationFrame::Kind::Command: {
+                    Book& book = *books_.at(s.book);
+                    ApplyCommand(book, s.command, s.At());
+                    if (checksumEvery_ && s.sequence % checksumEvery_ == 0) Match(theirs_, mine_, s.sequence, BookChecksum(book));
+                    applied_.store(s.sequence, std::memory_order_release);
+                    break;
+                }
+            }
+        }
+        lost_.store(true);
+    }
+};
+
+// ----- benchmarks -----
+// resting ladder of small orders on both sides, then aggressive orders sweeping several levels each
+inline CommandStream GenerateSweepCommands(uint64_t seed, size_t sweeps, Price levels = 20, int ordersPerLevel = 8) {
+    std::mt19937_64 rng(seed);
+    CommandStream stream;
+    OrderId nextId = 1;
+    const Price mid = 1000;
+    for (size_t s = 0; s < sweeps; ++s) {
+        for (Price d = 1; d <= levels; ++d)
+            for (int k = 0; k < ordersPerLevel; ++k) {
+                stream.push_back({CommandType::Add, OrderType::GoodTillCancel, nextId++, Side::Sell, mid + d, Quantity(1 + rng() % 5)});
+                stream.push_back({CommandType::Add, OrderType::GoodTillCancel, nextId++, Side::Buy, mid - d, Quantity(1 + rng() % 5)});
+            }
+        const Quantity sweepQty = Quantity(levels * ordersPerLevel * 3);
+        stream.push_back({CommandType::Add, OrderType::FillAndKill, nextId++, Side::Buy, mid + levels, sweepQty});
+        stream.push_back({CommandType::Add, OrderType::FillAndKill, nextId++, Side::Sell, mid - levels, sweepQty});
+    }
+    return stream;
+}
+
+struct Workload { const char* name; CommandStream commands; };
+
+inline std::vector<Workload> StandardWorkloads() {
+    GeneratorConfig churn; churn.priceSpread = 5; churn.cancelPercent = 45; churn.modifyPercent = 15;
+    GeneratorConfig deep; deep.midPrice = 5000; deep.priceSpread = 2000; deep.cancelPercent = 10;
+    return {
+        {"mixed", GenerateCommands(42, 200000)},
+        {"touch-churn", GenerateCommands(43, 200000, churn)},
+        {"deep-book", GenerateCommands(44, 200000, deep)},
+        {"sweeps", GenerateSweepCommands(45, 500)},
+    };
+}
+
+// best-of-N wall time per command, fresh book each run
+template<MatchingEngine Book>
+double NanosPerCommand(const CommandStream& stream, int runs = 3) {
+    double best = std::numeric_limits<double>::max();
+    for (int r = 0; r < runs; ++r) {
+        Book book;
+        size_t trades = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (const auto& c : stream) trades += ApplyCommand(book, c).trades.size();
+        const auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        best = std::min(best, elapsed / double(stream.size()));
+        if (trades == std::numeric_limits<size_t>::max()) std::cout << ""; // keep the work observable
+    }
+    return best;
+}
+
+// only the aggressive order is timed: rest levels x ordersPerLevel unit asks, then one buy sweeps them all
+template<MatchingEngine Book>
+double NanosPerSweepFill(Price levels = 50, int ordersPerLevel = 20, int sweeps = 200) {
+    Book book;
+    OrderId nextId = 1;
+    size_t fills = 0;
+    std::chrono::steady_clock::duration elapsed{};
+    for (int s = 0; s < sweeps; ++s) {
+        for (Price d = 1; d <= levels; ++d)
+            for (int k = 0; k < ordersPerLevel; ++k) book.Submit(std::make_shared<Order>(OrderType::GoodTillCancel, nextId++, Side::Sell, 1000 + d, 1));
+        auto sweep = std::make_shared<Order>(OrderType::FillAndKill, nextId++, Side::Buy, 1000 + levels, Quantity(levels * ordersPerLevel));
+        const auto start = std::chrono::steady_clock::now();
+        fills += book.Submit(sweep).trades.size();
+        elapsed += std::chrono::steady_clock::now() - start;
+    }
+    return std::chrono::duration<double, std::nano>(elapsed).count() / double(fills);
+}
+
+template<MatchingEngine Book>
+void BenchBackend(const char* name, const std::vector<Workload>& workloads) {
+    std::cout << std::format("{:<10}", name);
+    for (const auto& w : workloads) std::cout << std::format("  {:>12.1f}", NanosPerCommand<Book>(w.commands));
+    std::cout << std::format("  {:>12.1f}\n", NanosPerSweepFill<Book>());
+}
+
+// gateway-side price text: ParseFixed/FormatFixed against strtod/snprintf on the same strings
+inline void BenchDecimal(size_t count = 1 << 20) {
+    std::mt19937_64 rng(46);
+    std::vector<std::string> texts(count);
+    std::vector<int64_t> values(count);
+    for (size_t i = 0; i < count; ++i) {
+        values[i] = int64_t(rng() % 100000000);
+        char buf[32];
+        texts[i].assign(buf, FormatFixed(buf, values[i], 4));
+    }
+    auto time = [&](auto&& body) {
+        int64_t sink = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; ++i) sink += body(i);
+        const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / double(count);
+        if (sink == std::numeric_limits<int64_t>::min()) std::cout << ""; // keep the work observable
+        return ns;
+    };
+    char buf[32];
+    const double parse = time([&](size_t i) { return *ParseFixed(texts[i], 4); });
+    const double strtod = time([&](size_t i) { return std::llround(std::strtod(texts[i].c_str(), nullptr) * 1e4); });
+    const double format = time([&](size_t i) { return FormatFixed(buf, values[i], 4) - buf; });
+    const double snprintf = time([&](size_t i) { return int64_t(std::snprintf(buf, sizeof(buf), "%.4f", double(values[i]) / 1e4)); });
+    std::cout << std::format("decimal ns/op: parse {:.1f} (strtod {:.1f}), format {:.1f} (snprintf {:.1f})\n", parse, strtod, format, snprintf);
+}
+
+// ----- main -----
+#if defined(ORDERBOOK_SINGLE_MAIN)
+int main(){
+    OrderBook ob;
+    auto o1=std::make_shared<Order>(OrderType::GoodTillCancel,1,Side::Buy,100,10);
+    auto o2=std::make_shared<Order>(OrderType::GoodTillCancel,2,Side::Sell,99,5);
+    auto trades=ob.AddOrder(o1); trades=ob.AddOrder(o2);
+    for(auto &t: trades) std::cout<<std::format("Trade #{}: bid={} ask={} px={} qty={} aggressor={}\n", t.sequence,t.bid.orderId,t.ask.orderId,t.bid.price,t.bid.quantity,t.aggressor==Side::Buy?"buy":"sell");
+    std::cout<<"size: "<<ob.Size()<<"\n";
+    auto dup=ob.Submit(std::make_shared<Order>(OrderType::GoodTillCancel,1,Side::Buy,100,10));
+    std::cout<<"resubmit id 1: "<<RejectReasonName(dup.reject)<<"\n";
+    return 0;
+}
+#elif defined(ORDERBOOK_DIFF_MAIN)
+int main(int argc, char** argv){
+    struct Run { CommandStream stream; BookConfig config; const char* what; };
+    std::vector<Run> runs;
+    uint64_t seed = 1;
+    if (argc > 2 && std::string(argv[1]) == "--replay") {
+        std::ifstream in(argv[2]);
+        if (!in) { std::cerr << "cannot open " << argv[2] << "\n"; return 2; }
+        runs.push_back({LoadCommands(in), {}, "replayed"});
+    } else {
+        if (argc > 1) seed = std::stoull(argv[1]);
+        const size_t events = argc > 2 ? std::stoull(argv[2]) : 10000;
+        GeneratorConfig wide; wide.midPrice = 5000; wide.priceSpread = 3000; // forces ladder regrowth and deep trees
+        GeneratorConfig sessions; sessions.sessionPercent = 2; sessions.owners = 8; // auctions, halts, disconnects
+        GeneratorConfig limited = sessions; limited.priceSpread = 25; // orders past the band, sweeps past the halt bounds, reopens
+        const BookConfig limits{PriceLimits{1000, 150, 80, std::chrono::minutes(1)}};
+        // tick 1 below 1000 and 2 from there, lots of 2 up to 40: about half the adds and modifies are off tick or lot
+        static constexpr InstrumentSpec Instrument{2, {{0, 1}, {1000, 2}}, 2, 2, 40};
+        runs.push_back({GenerateCommands(seed, events), {}, "plain"});
+        runs.push_back({GenerateCommands(seed + 1, events, wide), {}, "wide"});
+        runs.push_back({GenerateCommands(seed + 2, events, sessions), {}, "sessions"});
+        runs.push_back({GenerateCommands(seed + 3, events, limited), limits, "price limits"});
+        runs.push_back({GenerateCommands(seed + 4, events, sessions), BookConfig{{}, &Instrument}, "tick and lot tables"});
+    }
+    bool ok = true;
+    for (const auto& [stream, config, what] : runs) {
+        ok &= CheckEquivalent<OrderBook, LadderOrderBook>(stream, "Ladder", config);
+        ok &= CheckEquivalent<OrderBook, FlatOrderBook>(stream, "Flat", config);
+        ok &= CheckEquivalent<OrderBook, SkipListOrderBook>(stream, "SkipList", config);
+        ok &= CheckEquivalent<OrderBook, HybridOrderBook>(stream, "Hybrid", config);
+        std::cout << std::format("{} commands, {}: {}\n", stream.size(), what, ok ? "equivalent" : "DIVERGED");
+    }
+    const bool decimal = CheckDecimalText(seed, 100000);
+    std::cout << std::format("decimal text: {}\n", decimal ? "round-trips" : "FAILED");
+    const bool ownership = CheckAsyncOwnership();
+    std::cout << std::format("async ownership: {}\n", ownership ? "enforced" : "FAILED");
+    const bool sessions = CheckSessionTransitions<OrderBook>() && CheckSessionTransitions<LadderOrderBook>();
+    std::cout << std::format("session transitions: {}\n", sessions ? "as tabled" : "FAILED");
+    return ok && decimal && ownership && sessions ? 0 : 1;
+}
+#elif defined(ORDERBOOK_BENCH_MAIN)
+int main(){
+    const auto workloads = StandardWorkloads();
+    std::cout << std::format("{:<10}", "ns/cmd");
+    for (const auto& w : workloads) std::cout << std::format("  {:>12}", w.name);
+    std::cout << std::format("  {:>12}\n", "ns/sweepfill");
+    BenchBackend<OrderBook>("map", workloads);
+    BenchBackend<LadderOrderBook>("ladder", workloads);
+    BenchBackend<FlatOrderBook>("flat", workloads);
+    BenchBackend<SkipListOrderBook>("skiplist", workloads);
+    BenchBackend<HybridOrderBook>("hybrid", workloads);
+    BenchDecimal();
     return 0;
 }
 #endif